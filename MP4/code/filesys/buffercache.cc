@@ -0,0 +1,410 @@
+// buffercache.cc
+//	Routines to cache disk sectors in memory, between the file system
+//	and the synchronous disk.
+//
+//	Sectors are found through a small hash table chained through the
+//	buffers themselves, and replaced with the CLOCK algorithm.  Writes
+//	are delayed: a written sector stays dirty in the cache until it is
+//	evicted, or until Flush is called.  Since nothing can be written
+//	once Nachos is halting, the kernel flushes the cache whenever the
+//	file system must be consistent on disk -- after the file system
+//	commands, when a user program closes a file, exits or halts.
+//
+//	One lock protects the cache bookkeeping; it is released while a
+//	buffer is read from or written to the disk, and the buffer is
+//	marked busy instead.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "buffercache.h"
+#include "debug.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// CompareSectors
+// 	Order sector numbers for qsort.
+//----------------------------------------------------------------------
+
+static int
+CompareSectors(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::BufferCache
+// 	Initialize an empty cache of NumCacheBuffers sectors.
+//
+//	"disk" -- the disk the sectors are read from and written to
+//----------------------------------------------------------------------
+
+BufferCache::BufferCache(SynchDisk *disk)
+{
+    this->disk = disk;
+    buffers = new Buffer[NumCacheBuffers];
+    for (int i = 0; i < NumCacheBuffers; i++)
+    {
+        buffers[i].sector = -1;
+        buffers[i].dirty = FALSE;
+        buffers[i].referenced = FALSE;
+        buffers[i].busy = FALSE;
+        buffers[i].next = -1;
+    }
+    hand = 0;
+
+    numHashHeads = NumCacheBuffers;
+    hashHeads = new int[numHashHeads];
+    for (int i = 0; i < numHashHeads; i++)
+        hashHeads[i] = -1;
+
+    lock = new Lock("buffer cache lock");
+    ioDone = new Condition("buffer cache I/O done");
+}
+
+//----------------------------------------------------------------------
+// BufferCache::~BufferCache
+// 	De-allocate the cache.  Dirty buffers are lost; by the time the
+//	kernel is deleted the disk can no longer be written.
+//----------------------------------------------------------------------
+
+BufferCache::~BufferCache()
+{
+    delete ioDone;
+    delete lock;
+    delete[] hashHeads;
+    delete[] buffers;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Find
+// 	Return the buffer holding a sector, or -1 if it is not cached.
+//----------------------------------------------------------------------
+
+int BufferCache::Find(int sectorNumber)
+{
+    int which = hashHeads[sectorNumber % numHashHeads];
+    while (which != -1 && buffers[which].sector != sectorNumber)
+        which = buffers[which].next;
+    return which;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Unhash
+// 	Take a buffer out of the hash chain of the sector it holds.
+//----------------------------------------------------------------------
+
+void BufferCache::Unhash(int which)
+{
+    if (buffers[which].sector == -1)
+        return;
+
+    int *link = &hashHeads[buffers[which].sector % numHashHeads];
+    while (*link != which)
+        link = &buffers[*link].next;
+    *link = buffers[which].next;
+    buffers[which].next = -1;
+    buffers[which].sector = -1;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Hash
+// 	Make a free buffer hold a new sector.
+//----------------------------------------------------------------------
+
+void BufferCache::Hash(int which, int sectorNumber)
+{
+    int *head = &hashHeads[sectorNumber % numHashHeads];
+    buffers[which].sector = sectorNumber;
+    buffers[which].next = *head;
+    *head = which;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Evict
+// 	Run the clock hand until it finds a buffer that is neither busy,
+//	referenced nor dirty, and return it.  Dirty buffers on the way are
+//	written back, so they can be taken on the next pass.  Return -1
+//	if every buffer is busy.
+//
+//	Called with the lock held; the lock is released while writing.
+//----------------------------------------------------------------------
+
+int BufferCache::Evict()
+{
+    for (int scanned = 0; scanned < 3 * NumCacheBuffers; scanned++)
+    {
+        int which = hand;
+        Buffer *buffer = &buffers[which];
+        hand = (hand + 1) % NumCacheBuffers;
+
+        if (buffer->busy)
+            continue;
+        if (buffer->referenced)
+        {
+            buffer->referenced = FALSE; // second chance
+            continue;
+        }
+        if (buffer->dirty)
+        {
+            DEBUG(dbgFile, "Writing back sector " << buffer->sector);
+            buffer->busy = TRUE;
+            lock->Release();
+            disk->WriteSector(buffer->sector, buffer->data);
+            lock->Acquire();
+            buffer->busy = FALSE;
+            buffer->dirty = FALSE;
+            ioDone->Broadcast(lock);
+            // used again while it was written?
+            if (buffer->referenced)
+                continue;
+        }
+        return which;
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// BufferCache::GetBuffer
+// 	Return the buffer holding a sector, waiting while it is busy.  If
+//	the sector is not cached, take a buffer from the clock; it is then
+//	up to the caller to fill it.
+//
+//	Called and returns with the lock held.
+//
+//	"sectorNumber" -- the sector wanted
+//	"cached" -- set to whether the sector was already cached
+//----------------------------------------------------------------------
+
+int BufferCache::GetBuffer(int sectorNumber, bool *cached)
+{
+    ASSERT(sectorNumber >= 0 && sectorNumber < NumSectors);
+
+    for (;;)
+    {
+        int which = Find(sectorNumber);
+        if (which != -1)
+        {
+            if (buffers[which].busy)
+            {
+                ioDone->Wait(lock);
+                continue;
+            }
+            buffers[which].referenced = TRUE;
+            kernel->stats->numCacheHits++;
+            *cached = TRUE;
+            return which;
+        }
+
+        which = Evict();
+        if (which == -1)
+        {
+            ioDone->Wait(lock);
+            continue;
+        }
+        // someone else may have brought the sector in while Evict
+        // had the lock released
+        if (Find(sectorNumber) != -1)
+            continue;
+
+        Unhash(which);
+        Hash(which, sectorNumber);
+        buffers[which].referenced = TRUE;
+        kernel->stats->numCacheMisses++;
+        *cached = FALSE;
+        return which;
+    }
+}
+
+//----------------------------------------------------------------------
+// BufferCache::ReadSector
+// 	Copy the contents of a disk sector into a buffer, reading it from
+//	disk only if it is not cached.
+//
+//	"sectorNumber" -- the disk sector to read
+//	"data" -- the buffer to hold the contents of the disk sector
+//----------------------------------------------------------------------
+
+void BufferCache::ReadSector(int sectorNumber, char *data)
+{
+    ReadSectors(sectorNumber, data, 1);
+}
+
+//----------------------------------------------------------------------
+// BufferCache::WriteSector
+// 	Replace the cached contents of a disk sector.  The sector is
+//	written to disk later, when it is evicted or flushed.
+//
+//	"sectorNumber" -- the disk sector to be written
+//	"data" -- the new contents of the disk sector
+//----------------------------------------------------------------------
+
+void BufferCache::WriteSector(int sectorNumber, char *data)
+{
+    WriteSectors(sectorNumber, data, 1);
+}
+
+//----------------------------------------------------------------------
+// BufferCache::ReadSectors
+// 	Copy the contents of consecutive disk sectors into a buffer.  The
+//	cached ones are copied from memory; each run of ones that are not
+//	is read straight into "data" with a single disk request, and then
+//	kept in buffers taken for it, busy until the data arrives.
+//
+//	"sectorNumber" -- the first disk sector to read
+//	"data" -- the buffer to hold the contents of the disk sectors
+//	"count" -- the number of sectors to read
+//----------------------------------------------------------------------
+
+void BufferCache::ReadSectors(int sectorNumber, char *data, int count)
+{
+    int run[MaxCacheRun]; // buffers taken for a run of misses
+    bool cached;
+
+    lock->Acquire();
+    for (int i = 0; i < count;)
+    {
+        int which = GetBuffer(sectorNumber + i, &cached);
+        if (cached)
+        {
+            bcopy(buffers[which].data, &data[i * SectorSize], SectorSize);
+            i++;
+            continue;
+        }
+
+        int first = i;
+        int numRun = 0;
+        for (;;)
+        {
+            buffers[which].busy = TRUE;
+            run[numRun++] = which;
+            i++;
+            if (i == count || numRun == MaxCacheRun || Find(sectorNumber + i) != -1)
+                break;
+
+            // may release the lock, and someone may read the sector meanwhile
+            which = GetBuffer(sectorNumber + i, &cached);
+            if (cached)
+            {
+                bcopy(buffers[which].data, &data[i * SectorSize], SectorSize);
+                i++;
+                break;
+            }
+        }
+
+        lock->Release();
+        disk->ReadSectors(sectorNumber + first, &data[first * SectorSize], numRun);
+        lock->Acquire();
+        for (int j = 0; j < numRun; j++)
+        {
+            bcopy(&data[(first + j) * SectorSize], buffers[run[j]].data, SectorSize);
+            buffers[run[j]].busy = FALSE;
+        }
+        ioDone->Broadcast(lock);
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// BufferCache::WriteSectors
+// 	Replace the cached contents of consecutive disk sectors.  They are
+//	written to disk later, when evicted or flushed.  Writing back the
+//	contents a cached sector already has does not make it dirty; the
+//	free map, for one, is written in full after every change to a few
+//	of its bits.
+//
+//	"sectorNumber" -- the first disk sector to be written
+//	"data" -- the new contents of the disk sectors
+//	"count" -- the number of sectors to write
+//----------------------------------------------------------------------
+
+void BufferCache::WriteSectors(int sectorNumber, char *data, int count)
+{
+    bool cached;
+
+    lock->Acquire();
+    for (int i = 0; i < count; i++)
+    {
+        int which = GetBuffer(sectorNumber + i, &cached);
+        char *from = &data[i * SectorSize];
+        if (!cached || bcmp(buffers[which].data, from, SectorSize) != 0)
+        {
+            bcopy(from, buffers[which].data, SectorSize);
+            buffers[which].dirty = TRUE;
+        }
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// BufferCache::Flush
+// 	Write every dirty buffer back to disk, in increasing sector order
+//	so the disk head sweeps across once.  Dirty buffers of consecutive
+//	sectors are gathered and written with a single disk request.
+//----------------------------------------------------------------------
+
+void BufferCache::Flush()
+{
+    int *sectors = new int[NumCacheBuffers];
+    int numDirty = 0;
+    char *runData = new char[MaxCacheRun * SectorSize];
+    int run[MaxCacheRun];
+
+    lock->Acquire();
+    for (int i = 0; i < NumCacheBuffers; i++)
+    {
+        if (buffers[i].dirty)
+            sectors[numDirty++] = buffers[i].sector;
+    }
+    qsort(sectors, numDirty, sizeof(int), CompareSectors);
+    DEBUG(dbgFile, "Flushing " << numDirty << " dirty sectors");
+
+    for (int i = 0; i < numDirty;)
+    {
+        int first = sectors[i];
+        int numRun = 0;
+        while (i < numDirty && numRun < MaxCacheRun && sectors[i] == first + numRun)
+        {
+            int which = Find(sectors[i]);
+            if (which != -1 && buffers[which].busy)
+            {
+                if (numRun > 0)
+                    break; // write what we have first
+                ioDone->Wait(lock);
+                continue;
+            }
+            if (which == -1 || !buffers[which].dirty)
+            {
+                // evicted, and so written, meanwhile
+                if (numRun > 0)
+                    break;
+                if (++i < numDirty)
+                    first = sectors[i];
+                continue;
+            }
+
+            buffers[which].busy = TRUE;
+            bcopy(buffers[which].data, &runData[numRun * SectorSize], SectorSize);
+            run[numRun++] = which;
+            i++;
+        }
+        if (numRun == 0)
+            continue;
+
+        lock->Release();
+        disk->WriteSectors(first, runData, numRun);
+        lock->Acquire();
+        for (int j = 0; j < numRun; j++)
+        {
+            buffers[run[j]].busy = FALSE;
+            buffers[run[j]].dirty = FALSE;
+        }
+        ioDone->Broadcast(lock);
+    }
+    lock->Release();
+
+    delete[] runData;
+    delete[] sectors;
+}
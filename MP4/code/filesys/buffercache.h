@@ -0,0 +1,105 @@
+// buffercache.h
+//	Data structures for caching disk sectors in memory.
+//
+//	The file system reads and writes whole sectors through the buffer
+//	cache instead of going to the disk every time.  Repeated reads of
+//	the same sector (file headers, directories, the free map) are then
+//	served from memory, and writes are only sent to the disk when a
+//	dirty buffer is evicted or when the cache is flushed.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef BUFFERCACHE_H
+#define BUFFERCACHE_H
+
+#include "disk.h"
+#include "synch.h"
+#include "synchdisk.h"
+
+// Number of sectors kept in memory.  Large enough to hold the whole
+// free map file (NumSectors / BitsInByte / SectorSize = 1024 sectors),
+// which every Create and Remove reads and writes in full, plus the
+// headers and directories around it.
+#define NumCacheBuffers 2048
+
+// Most sectors moved to or from the disk in one request
+#define MaxCacheRun 64
+
+// The following class defines a write-back cache of disk sectors,
+// replaced with the CLOCK algorithm.
+//
+// Every buffer has a "referenced" bit that is set on each access; the
+// clock hand sweeps over the buffers, clearing the bits, and evicts the
+// first buffer found without one.  A dirty buffer is written back to
+// the disk before its memory is reused.
+//
+// A buffer is "busy" while its contents travel to or from the disk;
+// the cache lock is not held during the transfer, so other threads can
+// use the rest of the cache in the meantime, but any thread that wants
+// a busy buffer waits until the transfer is over.
+
+class BufferCache
+{
+public:
+    BufferCache(SynchDisk *disk); // Initialize an empty cache on
+                                  // top of "disk"
+    ~BufferCache();               // De-allocate the cache; does not
+                                  // flush, call Flush first
+
+    void ReadSector(int sectorNumber, char *data);
+    // Read/write a disk sector through the
+    // cache.  A write only updates the
+    // cached copy and marks it dirty.
+    void WriteSector(int sectorNumber, char *data);
+
+    void ReadSectors(int sectorNumber, char *data, int count);
+    // Read/write "count" consecutive sectors;
+    // the ones not cached are read from
+    // disk a run at a time.
+    void WriteSectors(int sectorNumber, char *data, int count);
+
+    void Flush(); // Write every dirty buffer back
+                  // to disk, in sector order, a run
+                  // of consecutive sectors at a time
+
+private:
+    class Buffer
+    {
+    public:
+        int sector;      // Sector held, -1 if the buffer is free
+        bool dirty;      // Modified since read from disk?
+        bool referenced; // Accessed since the clock hand last passed?
+        bool busy;       // Being transferred to or from disk?
+        int next;        // Next buffer in the same hash chain, -1 at the end
+        char data[SectorSize];
+    };
+
+    SynchDisk *disk;
+    Buffer *buffers;
+    int hand; // Position of the clock hand
+
+    int *hashHeads; // First buffer of every hash chain, -1 if empty
+    int numHashHeads;
+
+    Lock *lock;        // Protects all of the above
+    Condition *ioDone; // Signalled whenever a transfer finishes
+
+    int Find(int sectorNumber);             // Buffer holding the sector, -1 if none
+    void Unhash(int which);                 // Remove a buffer from its hash chain
+    void Hash(int which, int sectorNumber); // Make a buffer hold a new sector
+
+    int GetBuffer(int sectorNumber, bool *cached);
+    // Return the non-busy buffer holding
+    // the sector, taking one from the
+    // clock, without reading it, if it
+    // is not cached.  Called and returns
+    // with the lock held.
+    int Evict(); // Pick a buffer to reuse, writing it
+                 // back if dirty; -1 if all are busy
+};
+
+#endif // BUFFERCACHE_H
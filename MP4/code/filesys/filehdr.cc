@@ -13,6 +13,17 @@
 //      Unlike in a real system, we do not keep track of file permissions,
 //	ownership, last modification date, etc., in the file header.
 //
+//	Files are first given an extent header: their data is allocated as
+//	a few runs of consecutive sectors, listed as (start, length) pairs.
+//	Only when free space is too fragmented for that, the header falls
+//	back to a table of single sectors.
+//
+//	Files bigger than MaxFileSizeLevel1 are indexed by up to three
+//	levels of sub-headers, each stored in a sector of its own.  The
+//	sub-headers are read from disk on first use and then kept in
+//	memory, below the header that points to them, for as long as the
+//	header lives -- for an open file, until the OpenFile is deleted.
+//
 //	A file header can be initialized in two ways:
 //	   for a new file, by modifying the in-memory data structure
 //	     to point to the newly allocated data blocks
@@ -26,7 +37,7 @@
 
 #include "filehdr.h"
 #include "debug.h"
-#include "synchdisk.h"
+#include "buffercache.h"
 #include "main.h"
 
 //----------------------------------------------------------------------
@@ -41,18 +52,119 @@ FileHeader::FileHeader()
 	numBytes = -1;
 	numSectors = -1;
 	memset(dataSectors, -1, sizeof(dataSectors));
+	for (int i = 0; i < (int)NumDirect; i++)
+		subHdrs[i] = NULL;
 }
 
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::~FileHeader
-//	Currently, there is not need to do anything in destructor function.
-//	However, if you decide to add some "in-core" data in header
-//	Always remember to deallocate their space or you will leak memory
+//	De-allocate the sub-headers read into memory, and in turn theirs.
 //----------------------------------------------------------------------
 FileHeader::~FileHeader()
 {
-	// nothing to do now
+	FreeSubHeaders();
+}
+
+//----------------------------------------------------------------------
+// FileHeader::FreeSubHeaders
+//	Delete the in-core sub-headers, they will be read again if needed.
+//----------------------------------------------------------------------
+void FileHeader::FreeSubHeaders()
+{
+	for (int i = 0; i < (int)NumDirect; i++)
+	{
+		delete subHdrs[i];
+		subHdrs[i] = NULL;
+	}
+}
+
+//----------------------------------------------------------------------
+// FileHeader::SubHeaderSize
+//	Return how many bytes of the file each sub-header indexes.
+//	Only meaningful for files bigger than MaxFileSizeLevel1.
+//----------------------------------------------------------------------
+int FileHeader::SubHeaderSize()
+{
+	if (numBytes > (int)MaxFileSizeLevel3)
+		return MaxFileSizeLevel3;
+	else if (numBytes > (int)MaxFileSizeLevel2)
+		return MaxFileSizeLevel2;
+	return MaxFileSizeLevel1;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::SubHeader
+//	Return the sub-header stored in dataSectors[i], fetching it from
+//	disk the first time it is asked for.
+//
+//	"i" is the index of the sub-header in dataSectors
+//----------------------------------------------------------------------
+FileHeader *FileHeader::SubHeader(int i)
+{
+	ASSERT(numBytes > (int)MaxFileSizeLevel1 && i >= 0 && i < numSectors);
+	if (subHdrs[i] == NULL)
+	{
+		subHdrs[i] = new FileHeader;
+		subHdrs[i]->FetchFrom(dataSectors[i]);
+	}
+	return subHdrs[i];
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AllocateExtents
+// 	Allocate the data sectors of the file as at most NumExtents runs
+//	of consecutive sectors, the longest ones the free map has: a run
+//	that cannot be found is asked for again at half the length.
+//	Return FALSE, with nothing allocated, if the runs found are too
+//	many or too short.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"sectors" is the number of data sectors wanted
+//	"goal" is where to start looking for the first run
+//----------------------------------------------------------------------
+
+bool FileHeader::AllocateExtents(PersistentBitmap *freeMap, int sectors, int goal)
+{
+	int numExtents = 0;
+	int length = sectors;
+
+	while (sectors > 0 && numExtents < (int)NumExtents)
+	{
+		if (length > sectors)
+			length = sectors;
+
+		int start = freeMap->FindAndSetRun(length, goal);
+		if (start == -1)
+		{
+			if (length == 1)
+				break;
+			length = divRoundUp(length, 2);
+			continue;
+		}
+
+		dataSectors[2 * numExtents] = start;
+		dataSectors[2 * numExtents + 1] = length;
+		numExtents++;
+		sectors -= length;
+		if (start + length < NumSectors)
+			goal = start + length; // the next run right after, if it can be
+	}
+
+	if (sectors > 0)
+	{
+		for (int i = 0; i < numExtents; i++)
+		{
+			for (int j = 0; j < dataSectors[2 * i + 1]; j++)
+				freeMap->Clear(dataSectors[2 * i] + j);
+		}
+		memset(dataSectors, -1, sizeof(dataSectors));
+		return FALSE;
+	}
+
+	numSectors = -numExtents;
+	DEBUG(dbgFile, "Allocated " << numBytes << " bytes in " << numExtents << " extents");
+	return TRUE;
 }
 
 //----------------------------------------------------------------------
@@ -64,14 +176,22 @@ FileHeader::~FileHeader()
 //
 //	"freeMap" is the bit map of free disk sectors
 //	"fileSize" is the bit map of free disk sectors
+//	"goal" is the sector the file data should preferably start at,
+//	   usually right after the file header
 //----------------------------------------------------------------------
 
-bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
+bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize, int goal)
 {
+	FreeSubHeaders();
 	numBytes = fileSize;
 
 	// MP4
 	numSectors = divRoundUp(fileSize, SectorSize);
+
+	if (freeMap->NumClear() < numSectors)
+		return FALSE; // not enough space, however it is laid out
+	if (AllocateExtents(freeMap, numSectors, goal))
+		return TRUE;
 	
 	int totalHdrSectors = 1;
 	if (numBytes > MaxFileSizeLevel3) {
@@ -102,15 +222,16 @@ bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 		for (int i = 0; i < numSectors; i++) {
 			if (fileSize <= 0) break;
 
-			dataSectors[i] = freeMap->FindAndSet();
+			dataSectors[i] = freeMap->FindAndSetNear(goal);
 			FileHeader* subHdr = new FileHeader();
+			subHdrs[i] = subHdr;
 
 			if (fileSize >= MaxFileSizeLevel3) {
-				subHdr->Allocate(freeMap, MaxFileSizeLevel3);
+				subHdr->Allocate(freeMap, MaxFileSizeLevel3, dataSectors[i]);
 				fileSize -= MaxFileSizeLevel3;
 				subHdr->WriteBack(dataSectors[i]);
 			}else {
-				subHdr->Allocate(freeMap, fileSize);
+				subHdr->Allocate(freeMap, fileSize, dataSectors[i]);
 				fileSize -= fileSize;
 				subHdr->WriteBack(dataSectors[i]);
 			}
@@ -122,15 +243,16 @@ bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 		for (int i = 0; i < numSectors; i++) {
 			if (fileSize <= 0) break;
 
-			dataSectors[i] = freeMap->FindAndSet();
+			dataSectors[i] = freeMap->FindAndSetNear(goal);
 			FileHeader* subHdr = new FileHeader();
+			subHdrs[i] = subHdr;
 
 			if (fileSize >= MaxFileSizeLevel2) {
-				subHdr->Allocate(freeMap, MaxFileSizeLevel2);
+				subHdr->Allocate(freeMap, MaxFileSizeLevel2, dataSectors[i]);
 				fileSize -= MaxFileSizeLevel2;
 				subHdr->WriteBack(dataSectors[i]);
 			}else {
-				subHdr->Allocate(freeMap, fileSize);
+				subHdr->Allocate(freeMap, fileSize, dataSectors[i]);
 				fileSize -= fileSize;
 				subHdr->WriteBack(dataSectors[i]);
 			}
@@ -142,15 +264,16 @@ bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 		for (int i = 0; i < numSectors; i++) {
 			if (fileSize <= 0) break;
 
-			dataSectors[i] = freeMap->FindAndSet();
+			dataSectors[i] = freeMap->FindAndSetNear(goal);
 			FileHeader* subHdr = new FileHeader();
+			subHdrs[i] = subHdr;
 
 			if (fileSize >= MaxFileSizeLevel1) {
-				subHdr->Allocate(freeMap, MaxFileSizeLevel1);
+				subHdr->Allocate(freeMap, MaxFileSizeLevel1, dataSectors[i]);
 				fileSize -= MaxFileSizeLevel1;
 				subHdr->WriteBack(dataSectors[i]);
 			}else {
-				subHdr->Allocate(freeMap, fileSize);
+				subHdr->Allocate(freeMap, fileSize, dataSectors[i]);
 				fileSize -= fileSize;
 				subHdr->WriteBack(dataSectors[i]);
 			}
@@ -161,7 +284,7 @@ bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 	else {
 		for (int i = 0; i < numSectors; i++)
 		{
-			dataSectors[i] = freeMap->FindAndSet();
+			dataSectors[i] = freeMap->FindAndSetNear(goal);
 			// since we checked that there was enough free space,
 			// we expect this to succeed
 			ASSERT(dataSectors[i] >= 0);
@@ -188,7 +311,14 @@ bool FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 
 void FileHeader::Deallocate(PersistentBitmap *freeMap)
 {
-	if (numBytes <= MaxFileSizeLevel1) {
+	if (IsExtentHeader()) {
+		for (int i = 0; i < -numSectors; i++) {
+			for (int j = 0; j < dataSectors[2 * i + 1]; j++) {
+				ASSERT(freeMap->Test(dataSectors[2 * i] + j)); // ought to be marked!
+				freeMap->Clear(dataSectors[2 * i] + j);
+			}
+		}
+	}else if (numBytes <= (int)MaxFileSizeLevel1) {
 		for (int i = 0; i < numSectors; i++){
 			ASSERT(freeMap->Test((int)dataSectors[i])); // ought to be marked!
 			freeMap->Clear((int)dataSectors[i]);
@@ -197,9 +327,7 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap)
 		for (int i = 0; i < numSectors; i++) {
 			ASSERT(freeMap->Test((int)dataSectors[i])); // ought to be marked!
 
-			FileHeader* subHdr = new FileHeader;
-			subHdr->FetchFrom(dataSectors[i]);
-			subHdr->Deallocate(freeMap);
+			SubHeader(i)->Deallocate(freeMap);
 
 			freeMap->Clear((int)dataSectors[i]);
 		}
@@ -220,12 +348,9 @@ void FileHeader::Deallocate(PersistentBitmap *freeMap)
 
 void FileHeader::FetchFrom(int sector)
 {
-	kernel->synchDisk->ReadSector(sector, (char *)this);
-
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you will need to rebuild the header's structure
-	*/
+	// the sub-headers of whatever this header held before are stale
+	FreeSubHeaders();
+	kernel->bufferCache->ReadSector(sector, (char *)this);
 }
 
 //----------------------------------------------------------------------
@@ -237,16 +362,8 @@ void FileHeader::FetchFrom(int sector)
 
 void FileHeader::WriteBack(int sector)
 {
-	kernel->synchDisk->WriteSector(sector, (char *)this);
-
-	/*
-		MP4 Hint:
-		After you add some in-core informations, you may not want to write all fields into disk.
-		Use this instead:
-		char buf[SectorSize];
-		memcpy(buf + offset, &dataToBeWritten, sizeof(dataToBeWritten));
-		...
-	*/
+	// only the disk part, which comes first and fills one sector
+	kernel->bufferCache->WriteSector(sector, (char *)this);
 }
 
 //----------------------------------------------------------------------
@@ -261,26 +378,21 @@ void FileHeader::WriteBack(int sector)
 
 int FileHeader::ByteToSector(int offset)
 {
-	if (numBytes > MaxFileSizeLevel3) {
-		FileHeader *subHdr = new FileHeader;
-		int dataSectorIndex = offset / MaxFileSizeLevel3;
-		subHdr->FetchFrom(dataSectors[dataSectorIndex]);
-
-		return subHdr->ByteToSector(offset - MaxFileSizeLevel3 * dataSectorIndex);
-	}
-	else if (numBytes > MaxFileSizeLevel2) {
-		FileHeader *subHdr = new FileHeader;
-		int dataSectorIndex = offset / MaxFileSizeLevel2;
-		subHdr->FetchFrom(dataSectors[dataSectorIndex]);
-
-		return subHdr->ByteToSector(offset - MaxFileSizeLevel2 * dataSectorIndex);
+	if (IsExtentHeader()) {
+		int sector = offset / SectorSize;
+		for (int i = 0; i < -numSectors; i++) {
+			if (sector < dataSectors[2 * i + 1])
+				return dataSectors[2 * i] + sector;
+			sector -= dataSectors[2 * i + 1];
+		}
+		ASSERTNOTREACHED();
+		return -1;
 	}
-	else if (numBytes > MaxFileSizeLevel1) {
-		FileHeader *subHdr = new FileHeader;
-		int dataSectorIndex = offset / MaxFileSizeLevel1;
-		subHdr->FetchFrom(dataSectors[dataSectorIndex]);
+	else if (numBytes > (int)MaxFileSizeLevel1) {
+		int subHdrSize = SubHeaderSize();
+		int dataSectorIndex = offset / subHdrSize;
 
-		return subHdr->ByteToSector(offset - MaxFileSizeLevel1 * dataSectorIndex);
+		return SubHeader(dataSectorIndex)->ByteToSector(offset - subHdrSize * dataSectorIndex);
 	}
 	else {
 		return dataSectors[offset / SectorSize];
@@ -315,7 +427,7 @@ void FileHeader::Print()
 	// printf("\nFile contents:\n");
 	// for (i = k = 0; i < numSectors; i++)
 	// {
-	// 	kernel->synchDisk->ReadSector(dataSectors[i], data);
+	// 	kernel->bufferCache->ReadSector(dataSectors[i], data);
 	// 	for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++)
 	// 	{
 	// 		if ('\040' <= data[j] && data[j] <= '\176') // isprint(data[j])
@@ -331,6 +443,28 @@ void FileHeader::Print()
 	char *data = new char[SectorSize];
 
 	printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
+	if (IsExtentHeader()) {
+		for (i = 0; i < -numSectors; i++)
+			for (j = 0; j < dataSectors[2 * i + 1]; j++)
+				printf("%d ", dataSectors[2 * i] + j);
+		printf("\nFile contents:\n");
+
+		for (k = 0; k < numBytes;)
+		{
+			kernel->bufferCache->ReadSector(ByteToSector(k), data);
+			for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++)
+			{
+				if ('\040' <= data[j] && data[j] <= '\176') // isprint(data[j])
+					printf("%c", data[j]);
+				else
+					printf("\\%x", (unsigned char)data[j]);
+			}
+			printf("\n");
+		}
+		delete[] data;
+		return;
+	}
+
 	for (i = 0; i < numSectors; i++)
 		printf("%d ", dataSectors[i]);
 	printf("\nFile contents:\n");
@@ -338,12 +472,10 @@ void FileHeader::Print()
 	for (i = k = 0; i < numSectors; i++)
 	{
 		if (numBytes > MaxFileSizeLevel1) {
-			FileHeader *subHdr = new FileHeader;
-			subHdr->FetchFrom(dataSectors[i]);
-			subHdr->Print();	
+			SubHeader(i)->Print();
 		}
 		else {
-			kernel->synchDisk->ReadSector(dataSectors[i], data);
+			kernel->bufferCache->ReadSector(dataSectors[i], data);
 			for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++)
 			{
 				if ('\040' <= data[j] && data[j] <= '\176') // isprint(data[j])
@@ -352,8 +484,7 @@ void FileHeader::Print()
 					printf("\\%x", (unsigned char)data[j]);
 			}
 			printf("\n");
-
-			delete[] data;
 		}
 	}
+	delete[] data;
 }
@@ -26,6 +26,10 @@
 #define MaxFileSizeLevel3 (NumDirect * NumDirect * NumDirect * SectorSize)	// 30^3 * 128
 #define MaxFileSizeLevel4 (NumDirect * NumDirect * NumDirect * NumDirect * SectorSize)	// 30^4 * 128
 
+// An extent header keeps (start, length) pairs of contiguous data sectors
+// in dataSectors instead of single sector numbers
+#define NumExtents (NumDirect / 2)
+
 // The following class defines the Nachos "file header" (in UNIX terms,
 // the "i-node"), describing where on disk to find all of the data in the file.
 // The file header is organized as a simple table of pointers to
@@ -37,6 +41,12 @@
 // as one disk sector.  Without indirect addressing, this
 // limits the maximum file length to just under 4K bytes.
 //
+// A file whose data fits in at most NumExtents runs of consecutive
+// sectors gets an extent header instead, whatever its size: dataSectors
+// then holds the first sector and the length of every run, and
+// numSectors holds minus the number of runs.  Consecutive sectors let
+// a sequential read or write stay on the same track.
+//
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
 // reading it from disk.
@@ -48,9 +58,12 @@ public:
 	FileHeader(); // dummy constructor to keep valgrind happy
 	~FileHeader();
 
-	bool Allocate(PersistentBitmap *bitMap, int fileSize); // Initialize a file header,
+	bool Allocate(PersistentBitmap *bitMap, int fileSize,
+				  int goal = 0);						   // Initialize a file header,
 														   //  including allocating space
-														   //  on disk for the file data
+														   //  on disk for the file data,
+														   //  from sector "goal" on if
+														   //  there is room
 	void Deallocate(PersistentBitmap *bitMap);			   // De-allocate this file's
 														   //  data blocks
 
@@ -79,14 +92,34 @@ private:
 		
 		Disk Part - numBytes, numSectors, dataSectors occupy exactly 128 bytes and will be
 		written to a sector on disk.
-		In-core part - none
+		In-core part - subHdrs, the sub-headers already read from disk, so
+		translating an offset of a big file does not re-read the index sectors.
 		
 	*/
 
 	int numBytes;				// Number of bytes in the file
-	int numSectors;				// Number of data sectors in the file
+	int numSectors;				// Number of data sectors in the file,
+								// or minus the number of extents
 	int dataSectors[NumDirect]; // Disk sector numbers for each data
-								// block in the file
+								// block in the file, or for each
+								// sub-header if the file is bigger
+								// than MaxFileSizeLevel1, or the
+								// start and length of each extent
+
+	// In-core part, must follow the disk part
+	FileHeader *subHdrs[NumDirect]; // Sub-header stored in each of
+									// dataSectors, NULL until first used
+
+	bool IsExtentHeader() { return numSectors < 0; }
+	bool AllocateExtents(PersistentBitmap *freeMap, int sectors, int goal);
+									 // Allocate "sectors" data sectors in
+									 //  at most NumExtents runs, FALSE if
+									 //  they are too fragmented
+
+	int SubHeaderSize();			 // Bytes of the file under each sub-header
+	FileHeader *SubHeader(int i);	 // Return the sub-header in dataSectors[i],
+									 //  reading it from disk on first use
+	void FreeSubHeaders();			 // Forget the sub-headers read so far
 };
 
 #endif // FILEHDR_H
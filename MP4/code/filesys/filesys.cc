@@ -51,6 +51,8 @@
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "buffercache.h"
+#include "main.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
 // and the directory of files.  These file headers are placed in well-known
@@ -65,6 +67,43 @@
 // #define NumDirEntries 10
 #define DirectoryFileSize (sizeof(DirectoryEntry) * NumDirEntries)
 
+// The disk is divided into block groups of consecutive tracks, in the
+// manner of the cylinder groups of the BSD fast file system.  A file's
+// header is placed after its directory's header, and its data after
+// its header, so they share a group and the seeks between them are
+// short.  Top-level directories start in the group with the most free
+// sectors, which spreads them, and their subtrees, over the disk.
+// When a group fills, allocation just continues into the next ones.
+#define TracksPerGroup 256
+#define SectorsPerGroup (TracksPerGroup * SectorsPerTrack)
+#define NumGroups (NumSectors / SectorsPerGroup)
+
+//----------------------------------------------------------------------
+// EmptiestGroup
+// 	Return the first sector of the block group with the most free
+//	sectors, the lowest numbered one on a tie.
+//
+//	"freeMap" is the bit map of free disk sectors
+//----------------------------------------------------------------------
+
+static int
+EmptiestGroup(PersistentBitmap *freeMap)
+{
+    int best = 0, bestClear = -1;
+
+    for (int i = 0; i < NumGroups; i++)
+    {
+        int clear = freeMap->NumClear(i * SectorsPerGroup, SectorsPerGroup);
+        if (clear > bestClear)
+        {
+            best = i;
+            bestClear = clear;
+        }
+    }
+    DEBUG(dbgFile, "Emptiest block group " << best << " has " << bestClear << " free sectors");
+    return best * SectorsPerGroup;
+}
+
 //----------------------------------------------------------------------
 // FileSystem::FileSystem
 // 	Initialize the file system.  If format = TRUE, the disk has
@@ -195,6 +234,7 @@ void FileSystem::CreateDirectory(char *name)
     directory = new Directory(NumDirEntries);
     directory->FetchFrom(directoryFile);
     OpenFile *currDirFile = directoryFile;
+    int currDirSector = DirectorySector;
 
      PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile, NumSectors);
     int sector;
@@ -214,10 +254,13 @@ void FileSystem::CreateDirectory(char *name)
             Directory *subDir = new Directory(NumDirEntries);
             FileHeader *subDirHdr = new FileHeader;
 
-            sector = freeMap->FindAndSet();
+            if (currDirSector == DirectorySector)
+                sector = freeMap->FindAndSetNear(EmptiestGroup(freeMap));
+            else
+                sector = freeMap->FindAndSetNear(currDirSector);
 
             directory->Add(token, sector, TRUE);
-            subDirHdr->Allocate(freeMap, DirectoryFileSize);
+            subDirHdr->Allocate(freeMap, DirectoryFileSize, sector);
 
             DEBUG(dbgFile, token << " at sector num " << sector);
 
@@ -231,6 +274,7 @@ void FileSystem::CreateDirectory(char *name)
             directory->FetchFrom(subDirFile);
             currDirFile = subDirFile;
         }
+        currDirSector = sector;
 
         token = strtok(NULL, "/");
         if (token == NULL) {
@@ -258,6 +302,7 @@ int FileSystem::Create(char *name, int initialSize)
     char *token = strtok(name, "/");
     char *prevToken = token;
     OpenFile *currDirFile = directoryFile;
+    int currDirSector = DirectorySector;
 
     while (true) {
         token = strtok(NULL, "/");
@@ -270,6 +315,7 @@ int FileSystem::Create(char *name, int initialSize)
         OpenFile* subDirFile = new OpenFile(sector);
         directory->FetchFrom(subDirFile);
         currDirFile = subDirFile;
+        currDirSector = sector;
 
         DEBUG(dbgFile, prevToken << " at sector num " << sector);
 
@@ -283,7 +329,7 @@ int FileSystem::Create(char *name, int initialSize)
     else
     {
         freeMap = new PersistentBitmap(freeMapFile, NumSectors);
-        sector = freeMap->FindAndSet(); // find a sector to hold the file header
+        sector = freeMap->FindAndSetNear(currDirSector); // find a sector to hold the file header
 
         if (sector == -1)
             success = FALSE; // no free block for file header
@@ -292,7 +338,7 @@ int FileSystem::Create(char *name, int initialSize)
         else
         {
             hdr = new FileHeader;
-            if (!hdr->Allocate(freeMap, initialSize))
+            if (!hdr->Allocate(freeMap, initialSize, sector))
                 success = FALSE; // no space on disk for data
             else
             {
@@ -385,6 +431,7 @@ int FileSystem::Write(char *buffer, int size, OpenFileId id){
 // MP4
 int FileSystem::Close(OpenFileId id){
     opfile = NULL;
+    kernel->bufferCache->Flush();
     return 1;
 }
 
@@ -16,7 +16,7 @@
 #include "main.h"
 #include "filehdr.h"
 #include "openfile.h"
-#include "synchdisk.h"
+#include "buffercache.h"
 
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
@@ -113,6 +113,7 @@ int OpenFile::ReadAt(char *into, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
     int i, firstSector, lastSector, numSectors;
+    int sector, run;
     char *buf;
 
     if ((numBytes <= 0) || (position >= fileLength))
@@ -125,11 +126,17 @@ int OpenFile::ReadAt(char *into, int numBytes, int position)
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
 
-    // read in all the full and partial sectors that we need
+    // read in all the full and partial sectors that we need, a run of
+    // sectors that are consecutive on disk at a time
     buf = new char[numSectors * SectorSize];
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize),
-                                      &buf[(i - firstSector) * SectorSize]);
+    for (i = firstSector; i <= lastSector; i += run)
+    {
+        sector = hdr->ByteToSector(i * SectorSize);
+        for (run = 1; i + run <= lastSector; run++)
+            if (hdr->ByteToSector((i + run) * SectorSize) != sector + run)
+                break;
+        kernel->bufferCache->ReadSectors(sector, &buf[(i - firstSector) * SectorSize], run);
+    }
 
     // copy the part we want
     bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
@@ -141,6 +148,7 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
     int i, firstSector, lastSector, numSectors;
+    int sector, run;
     bool firstAligned, lastAligned;
     char *buf;
 
@@ -171,10 +179,15 @@ int OpenFile::WriteAt(char *from, int numBytes, int position)
     // copy in the bytes we want to change
     bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
 
-    // write modified sectors back
-    for (i = firstSector; i <= lastSector; i++)
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize),
-                                       &buf[(i - firstSector) * SectorSize]);
+    // write modified sectors back, a run of consecutive ones at a time
+    for (i = firstSector; i <= lastSector; i += run)
+    {
+        sector = hdr->ByteToSector(i * SectorSize);
+        for (run = 1; i + run <= lastSector; run++)
+            if (hdr->ByteToSector((i + run) * SectorSize) != sector + run)
+                break;
+        kernel->bufferCache->WriteSectors(sector, &buf[(i - firstSector) * SectorSize], run);
+    }
     delete[] buf;
     return numBytes;
 }
@@ -5,10 +5,16 @@
 //	the disk providing a synchronous interface (requests wait until
 //	the request completes).
 //
-//	Use a semaphore to synchronize the interrupt handlers with the
-//	pending requests.  And, because the physical disk can only
-//	handle one operation at a time, use a lock to enforce mutual
-//	exclusion.
+//	Because the physical disk can only handle one operation at a time,
+//	requests wait in a queue, sorted by sector, until the disk is idle.
+//	The disk interrupt handler then picks the next one in C-LOOK order,
+//	so the head sweeps across the disk instead of seeking back and forth
+//	between threads.  Each request has a semaphore its thread waits on.
+//	Pending requests for consecutive sectors go to the disk together,
+//	through a buffer gathering or scattering their data.
+//
+//	The queue is shared with the interrupt handler, so it is protected
+//	by disabling interrupts rather than by a lock.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -17,6 +23,42 @@
 #include "copyright.h"
 #include "synchdisk.h"
 
+//----------------------------------------------------------------------
+// PendingCompare
+// 	Order disk requests by sector; requests for the same sector keep
+//	the order they were made in.
+//----------------------------------------------------------------------
+
+static int
+PendingCompare(DiskRequest *x, DiskRequest *y)
+{
+    return x->sector - y->sector;
+}
+
+//----------------------------------------------------------------------
+// DiskRequest::DiskRequest
+// 	Initialize a request for the disk.
+//
+//	"sectorNumber" -- the first disk sector to transfer
+//	"data" -- the buffer to read into or write from
+//	"count" -- the number of sectors to transfer
+//	"writing" -- TRUE for a write, FALSE for a read
+//----------------------------------------------------------------------
+
+DiskRequest::DiskRequest(int sectorNumber, char *data, int count, bool writing)
+{
+    sector = sectorNumber;
+    this->count = count;
+    this->data = data;
+    this->writing = writing;
+    done = new Semaphore("disk request", 0);
+}
+
+DiskRequest::~DiskRequest()
+{
+    delete done;
+}
+
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 // 	Initialize the synchronous interface to the physical disk, in turn
@@ -26,8 +68,10 @@
 
 SynchDisk::SynchDisk()
 {
-    semaphore = new Semaphore("synch disk", 0);
-    lock = new Lock("synch disk lock");
+    pending = new SortedList<DiskRequest *>(PendingCompare);
+    active = new List<DiskRequest *>;
+    headSector = 0; // where the Disk starts
+    runData = NULL;
     disk = new Disk(this);
 }
 
@@ -40,8 +84,8 @@ SynchDisk::SynchDisk()
 SynchDisk::~SynchDisk()
 {
     delete disk;
-    delete lock;
-    delete semaphore;
+    delete active;
+    delete pending;
 }
 
 //----------------------------------------------------------------------
@@ -55,10 +99,7 @@ SynchDisk::~SynchDisk()
 
 void SynchDisk::ReadSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
-    lock->Release();
+    ReadSectors(sectorNumber, data, 1);
 }
 
 //----------------------------------------------------------------------
@@ -72,19 +113,160 @@ void SynchDisk::ReadSector(int sectorNumber, char *data)
 
 void SynchDisk::WriteSector(int sectorNumber, char *data)
 {
-    lock->Acquire(); // only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P(); // wait for interrupt
-    lock->Release();
+    WriteSectors(sectorNumber, data, 1);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadSectors
+// 	Read the contents of consecutive disk sectors into a buffer, with
+//	a single disk request.  Return only after the data has been read.
+//
+//	"sectorNumber" -- the first disk sector to read
+//	"data" -- the buffer to hold the contents of the disk sectors
+//	"count" -- the number of sectors to read
+//----------------------------------------------------------------------
+
+void SynchDisk::ReadSectors(int sectorNumber, char *data, int count)
+{
+    DiskRequest *request = new DiskRequest(sectorNumber, data, count, FALSE);
+
+    Request(request);
+    delete request;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteSectors
+// 	Write the contents of a buffer into consecutive disk sectors, with
+//	a single disk request.  Return only after the data has been written.
+//
+//	"sectorNumber" -- the first disk sector to be written
+//	"data" -- the new contents of the disk sectors
+//	"count" -- the number of sectors to write
+//----------------------------------------------------------------------
+
+void SynchDisk::WriteSectors(int sectorNumber, char *data, int count)
+{
+    DiskRequest *request = new DiskRequest(sectorNumber, data, count, TRUE);
+
+    Request(request);
+    delete request;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Request
+// 	Queue a request, start the disk if it is idle, and wait until the
+//	request has been served.
+//----------------------------------------------------------------------
+
+void SynchDisk::Request(DiskRequest *request)
+{
+    IntStatus oldLevel = kernel->interrupt->SetLevel(IntOff);
+
+    pending->Insert(request);
+    if (active->IsEmpty())
+        StartNext();
+
+    (void)kernel->interrupt->SetLevel(oldLevel);
+    request->done->P(); // wait for interrupt
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartNext
+// 	Send the next request to the idle disk, in C-LOOK order: the first
+//	pending one at or after the head, or else the lowest one.
+//
+//	The pending requests that follow it in the list go along in the
+//	same transfer, as long as they go in the same direction and start
+//	right where the transfer ends -- or anywhere inside it, for reads.
+//	The first one that cannot stops the merging, so requests for the
+//	same sector are still served in order.
+//
+//	Called with interrupts disabled.
+//----------------------------------------------------------------------
+
+void SynchDisk::StartNext()
+{
+    ASSERT(active->IsEmpty() && runData == NULL);
+    if (pending->IsEmpty())
+        return;
+
+    DiskRequest *next = pending->Front();
+    ListIterator<DiskRequest *> iter(pending);
+    for (; !iter.IsDone(); iter.Next())
+    {
+        if (iter.Item()->sector >= headSector)
+        {
+            next = iter.Item();
+            break;
+        }
+    }
+
+    int end = next->sector + next->count;
+    ListIterator<DiskRequest *> others(pending);
+    while (others.Item() != next)
+        others.Next();
+    for (others.Next(); !others.IsDone(); others.Next())
+    {
+        DiskRequest *other = others.Item();
+        if (other->writing != next->writing)
+            break;
+        if (!other->writing && other->sector <= end)
+            end = max(end, other->sector + other->count); // overlaps or continues
+        else if (other->sector == end)
+            end += other->count;
+        else
+            break;
+        active->Append(other);
+    }
+    pending->Remove(next);
+    ListIterator<DiskRequest *> merged(active);
+    for (; !merged.IsDone(); merged.Next())
+        pending->Remove(merged.Item());
+    active->Prepend(next);
+
+    runSector = next->sector;
+    char *data = next->data;
+    if (active->NumInList() > 1)
+    {
+        runData = data = new char[(end - runSector) * SectorSize];
+        if (next->writing)
+        {
+            ListIterator<DiskRequest *> gather(active);
+            for (; !gather.IsDone(); gather.Next())
+            {
+                DiskRequest *request = gather.Item();
+                bcopy(request->data, &runData[(request->sector - runSector) * SectorSize],
+                      request->count * SectorSize);
+            }
+        }
+    }
+
+    headSector = end - 1;
+
+    if (next->writing)
+        disk->WriteSectors(runSector, data, end - runSector);
+    else
+        disk->ReadSectors(runSector, data, end - runSector);
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::CallBack
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// 	Disk interrupt handler.  Hand the data of a merged read out to its
+//	requests, wake up the threads waiting for the transfer that
+//	finished, and start the next one.
 //----------------------------------------------------------------------
 
 void SynchDisk::CallBack()
 {
-    semaphore->V();
+    while (!active->IsEmpty())
+    {
+        DiskRequest *request = active->RemoveFront();
+        if (runData != NULL && !request->writing)
+            bcopy(&runData[(request->sector - runSector) * SectorSize], request->data,
+                  request->count * SectorSize);
+        request->done->V();
+    }
+    delete[] runData;
+    runData = NULL;
+    StartNext();
 }
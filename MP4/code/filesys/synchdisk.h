@@ -15,6 +15,22 @@
 #include "synch.h"
 #include "callback.h"
 
+// A read or write of a run of consecutive sectors waiting for, or being
+// served by, the disk.
+
+class DiskRequest
+{
+public:
+    DiskRequest(int sectorNumber, char *data, int count, bool writing);
+    ~DiskRequest();
+
+    int sector;      // First sector to transfer
+    int count;       // Number of sectors to transfer
+    char *data;      // Where the data comes from or goes to
+    bool writing;    // Write, rather than read?
+    Semaphore *done; // V'ed once the transfer is over
+};
+
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
 // requests to read or write portions of the disk return immediately,
@@ -25,6 +41,12 @@
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
 // returning.
+//
+// Requests from different threads queue up while the disk is busy, and
+// are sent to it in C-LOOK order: the head sweeps towards higher sectors
+// serving every request on the way, then jumps back to the lowest one.
+// Queued requests that continue each other on disk are merged into one
+// transfer, and so are reads that overlap it.
 
 class SynchDisk : public CallBackObj
 {
@@ -36,21 +58,33 @@ public:
     void ReadSector(int sectorNumber, char *data);
     // Read/write a disk sector, returning
     // only once the data is actually read
-    // or written.  These call
-    // Disk::ReadRequest/WriteRequest and
-    // then wait until the request is done.
+    // or written.  These queue a request,
+    // and wait until the disk has done it.
     void WriteSector(int sectorNumber, char *data);
 
+    void ReadSectors(int sectorNumber, char *data, int count);
+    // Read/write "count" consecutive
+    // sectors, with a single disk request.
+    void WriteSectors(int sectorNumber, char *data, int count);
+
     void CallBack(); // Called by the disk device interrupt
                      // handler, to signal that the
                      // current disk operation is complete.
 
 private:
-    Disk *disk;           // Raw disk device
-    Semaphore *semaphore; // To synchronize requesting thread
-                          // with the interrupt handler
-    Lock *lock;           // Only one read/write request
-                          // can be sent to the disk at a time
+    Disk *disk;                           // Raw disk device
+    SortedList<DiskRequest *> *pending;   // Requests waiting for the disk,
+                                          // by sector
+    List<DiskRequest *> *active;          // Requests the disk is serving
+    int headSector;                       // Sector of the last request sent
+                                          // to the disk, where its head is
+    int runSector;                        // First sector being transferred
+    char *runData;                        // Data of a merged transfer,
+                                          // NULL if it serves one request
+
+    void Request(DiskRequest *request); // Queue a request and wait for it
+    void StartNext();                   // Send the next pending request,
+                                        // if any, to the idle disk
 };
 
 #endif // SYNCHDISK_H
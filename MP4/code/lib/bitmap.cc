@@ -31,10 +31,10 @@ Bitmap::Bitmap(int numItems)
     {
         map[i] = 0; // initialize map to keep Purify happy
     }
-    for (i = 0; i < numBits; i++)
-    {
-        Clear(i);
-    }
+
+    numSummaryWords = divRoundUp(numWords, BitsInWord);
+    summary = new unsigned int[numSummaryWords];
+    Recount();
 }
 
 //----------------------------------------------------------------------
@@ -44,9 +44,78 @@ Bitmap::Bitmap(int numItems)
 
 Bitmap::~Bitmap()
 {
+    delete[] summary;
     delete[] map;
 }
 
+//----------------------------------------------------------------------
+// Bitmap::ClearBits
+// 	Return the clear bits of a word of the map, as set bits.  The
+//	bits of the last word past "numBits" do not count.
+//
+//	"word" is the index of the word in the map.
+//----------------------------------------------------------------------
+
+unsigned int Bitmap::ClearBits(int word) const
+{
+    unsigned int bits = ~map[word];
+
+    if (word == numWords - 1 && numBits % BitsInWord != 0)
+    {
+        bits &= (1u << (numBits % BitsInWord)) - 1;
+    }
+    return bits;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::UpdateSummary
+// 	Set or clear the summary bit of a word of the map, depending on
+//	whether the word still has a clear bit.
+//
+//	"word" is the index of the word in the map.
+//----------------------------------------------------------------------
+
+void Bitmap::UpdateSummary(int word)
+{
+    unsigned int bit = 1u << (word % BitsInWord);
+
+    if (ClearBits(word) != 0)
+    {
+        summary[word / BitsInWord] |= bit;
+        if (word / BitsInWord < firstSummaryWord)
+        {
+            firstSummaryWord = word / BitsInWord;
+        }
+    }
+    else
+    {
+        summary[word / BitsInWord] &= ~bit;
+    }
+}
+
+//----------------------------------------------------------------------
+// Bitmap::Recount
+// 	Rebuild the count of clear bits and the summary from the map,
+//	after the map has been written other than through Mark and Clear
+//	(for instance, read from disk).
+//----------------------------------------------------------------------
+
+void Bitmap::Recount()
+{
+    numClear = 0;
+    for (int i = 0; i < numSummaryWords; i++)
+    {
+        summary[i] = 0;
+    }
+    firstSummaryWord = numSummaryWords;
+
+    for (int i = 0; i < numWords; i++)
+    {
+        numClear += __builtin_popcount(ClearBits(i));
+        UpdateSummary(i);
+    }
+}
+
 //----------------------------------------------------------------------
 // Bitmap::Set
 // 	Set the "nth" bit in a bitmap.
@@ -58,7 +127,12 @@ void Bitmap::Mark(int which)
 {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] |= 1 << (which % BitsInWord);
+    if (!Test(which))
+    {
+        map[which / BitsInWord] |= 1 << (which % BitsInWord);
+        numClear--;
+        UpdateSummary(which / BitsInWord);
+    }
 
     ASSERT(Test(which));
 }
@@ -74,7 +148,12 @@ void Bitmap::Clear(int which)
 {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+    if (Test(which))
+    {
+        map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+        numClear++;
+        UpdateSummary(which / BitsInWord);
+    }
 
     ASSERT(!Test(which));
 }
@@ -107,19 +186,164 @@ bool Bitmap::Test(int which) const
 //	(In other words, find and allocate a bit.)
 //
 //	If no bits are clear, return -1.
+//
+//	The first non-zero summary word leads to the first word of the
+//	map with a clear bit, and the lowest set bit of each is found
+//	with a single count-trailing-zeros.
 //----------------------------------------------------------------------
 
 int Bitmap::FindAndSet()
 {
-    for (int i = 0; i < numBits; i++)
+    if (numClear == 0)
+    {
+        return -1;
+    }
+
+    while (summary[firstSummaryWord] == 0)
+    {
+        firstSummaryWord++; // the words before were filled up
+    }
+    int word = firstSummaryWord * BitsInWord + __builtin_ctz(summary[firstSummaryWord]);
+    int which = word * BitsInWord + __builtin_ctz(ClearBits(word));
+
+    Mark(which);
+    return which;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FindAndSetNear
+// 	Return the number of the first clear bit at or after "goal", and
+//	set it.  If all of those are set, wrap around and return the first
+//	clear bit of the bitmap, as FindAndSet does.
+//
+//	If no bits are clear, return -1.
+//----------------------------------------------------------------------
+
+int Bitmap::FindAndSetNear(int goal)
+{
+    ASSERT(goal >= 0 && goal < numBits);
+
+    int word = goal / BitsInWord;
+    unsigned int bits = ClearBits(word) & (~0u << (goal % BitsInWord));
+
+    if (bits == 0)
+    {
+        word = NextWordWithClear(word + 1);
+        if (word == numWords)
+        {
+            return FindAndSet(); // wrap around
+        }
+        bits = ClearBits(word);
+    }
+
+    int which = word * BitsInWord + __builtin_ctz(bits);
+    Mark(which);
+    return which;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::NextWordWithClear
+// 	Return the index of the first word of the map, starting at "word",
+//	that has a clear bit; numWords if there is none.  Full words are
+//	skipped through the summary, a summary word at a time.
+//----------------------------------------------------------------------
+
+int Bitmap::NextWordWithClear(int word) const
+{
+    if (word >= numWords)
     {
-        if (!Test(i))
+        return numWords;
+    }
+
+    int i = word / BitsInWord;
+    unsigned int bits = summary[i] & (~0u << (word % BitsInWord));
+    while (bits == 0)
+    {
+        if (++i == numSummaryWords)
         {
-            Mark(i);
-            return i;
+            return numWords;
         }
+        bits = summary[i];
     }
-    return -1;
+    return i * BitsInWord + __builtin_ctz(bits);
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FindAndSetRun
+// 	Return the number of the first bit of the first run of "length"
+//	consecutive clear bits starting at or after "goal", and set them
+//	all (allocate them).  If there is none, look for the first such
+//	run from the start of the bitmap instead.
+//
+//	Words that are all clear extend a run 32 bits at a time, and full
+//	words are skipped through the summary; only the words where a
+//	run starts or ends are looked at bit by bit.
+//
+//	If there is no such run, return -1 and set nothing.
+//----------------------------------------------------------------------
+
+int Bitmap::FindAndSetRun(int length, int goal)
+{
+    ASSERT(length > 0 && goal >= 0 && goal < numBits);
+
+    if (length > numClear)
+    {
+        return -1;
+    }
+
+    int start = -1;
+    int found = 0; // clear bits from "start" so far
+
+    for (int word = NextWordWithClear(goal / BitsInWord); word < numWords && found < length; word++)
+    {
+        unsigned int bits = ClearBits(word);
+        if (word == goal / BitsInWord)
+        {
+            bits &= ~0u << (goal % BitsInWord);
+        }
+
+        if (bits == 0)
+        {
+            found = 0;
+            word = NextWordWithClear(word + 1) - 1;
+            continue;
+        }
+        if (bits == ~0u && found + BitsInWord <= length)
+        {
+            if (found == 0)
+            {
+                start = word * BitsInWord;
+            }
+            found += BitsInWord;
+            continue;
+        }
+
+        for (int bit = 0; bit < BitsInWord && found < length; bit++)
+        {
+            if (bits & (1u << bit))
+            {
+                if (found == 0)
+                {
+                    start = word * BitsInWord + bit;
+                }
+                found++;
+            }
+            else
+            {
+                found = 0;
+            }
+        }
+    }
+
+    if (found < length)
+    {
+        return goal == 0 ? -1 : FindAndSetRun(length, 0);
+    }
+    for (int i = start; i < start + length; i++)
+    {
+        Mark(i);
+    }
+    return start;
 }
 
 //----------------------------------------------------------------------
@@ -130,16 +354,39 @@ int Bitmap::FindAndSet()
 
 int Bitmap::NumClear() const
 {
-    int count = 0;
+    return numClear;
+}
 
-    for (int i = 0; i < numBits; i++)
+//----------------------------------------------------------------------
+// Bitmap::NumClear(int, int)
+// 	Return the number of clear bits in a range of the bitmap, counting
+//	whole words at a time.
+//
+//	"from" is the number of the first bit of the range.
+//	"count" is the number of bits in the range.
+//----------------------------------------------------------------------
+
+int Bitmap::NumClear(int from, int count) const
+{
+    ASSERT(from >= 0 && count >= 0 && from + count <= numBits);
+
+    int clear = 0;
+    int i = from;
+    int end = from + count;
+
+    for (; i < end && i % BitsInWord != 0; i++)
     {
-        if (!Test(i))
-        {
-            count++;
-        }
+        clear += !Test(i);
+    }
+    for (; i + BitsInWord <= end; i += BitsInWord)
+    {
+        clear += __builtin_popcount(ClearBits(i / BitsInWord));
+    }
+    for (; i < end; i++)
+    {
+        clear += !Test(i);
     }
-    return count;
+    return clear;
 }
 
 //----------------------------------------------------------------------
@@ -172,7 +419,7 @@ void Bitmap::SelfTest()
 {
     int i;
 
-    ASSERT(numBits >= BitsInWord); // bitmap must be big enough
+    ASSERT(numBits >= 3 * BitsInWord + 4); // bitmap must be big enough
 
     ASSERT(NumClear() == numBits); // bitmap must be empty
     ASSERT(FindAndSet() == 0);
@@ -184,13 +431,45 @@ void Bitmap::SelfTest()
     Clear(1);
     Clear(31);
 
+    ASSERT(NumClear() == numBits);
+
+    // clear bits found past full words, lowest first
+    for (i = 0; i < BitsInWord + 1; i++)
+    {
+        Mark(i);
+    }
+    Clear(BitsInWord - 1);
+    ASSERT(FindAndSet() == BitsInWord - 1);
+    ASSERT(FindAndSet() == BitsInWord + 1);
+    ASSERT(NumClear() == numBits - BitsInWord - 2);
+
+    // runs skip over set bits, and may span words
+    ASSERT(FindAndSetRun(BitsInWord) == BitsInWord + 2);
+    Clear(BitsInWord + 3);
+    ASSERT(FindAndSetRun(2) == 2 * BitsInWord + 2);
+    ASSERT(FindAndSetRun(1) == BitsInWord + 3);
+    ASSERT(FindAndSetRun(numBits) == -1);
+    ASSERT(NumClear() == numBits - 2 * BitsInWord - 4);
+
+    // searches from a goal, wrapping around to the start
+    ASSERT(FindAndSetNear(BitsInWord + 2) == 2 * BitsInWord + 4);
+    ASSERT(FindAndSetRun(2, 3 * BitsInWord) == 3 * BitsInWord);
+    ASSERT(FindAndSetNear(numBits - 1) == numBits - 1);
+    ASSERT(FindAndSetNear(numBits - 1) == 2 * BitsInWord + 5);
+    ASSERT(FindAndSetRun(2, numBits - 1) == 2 * BitsInWord + 6);
+    ASSERT(NumClear() == numBits - 2 * BitsInWord - 11);
+    ASSERT(NumClear(0, numBits) == NumClear());
+    ASSERT(NumClear(2 * BitsInWord + 3, BitsInWord) == BitsInWord - 7);
+
     for (i = 0; i < numBits; i++)
     {
         Mark(i);
     }
+    ASSERT(NumClear() == 0);
     ASSERT(FindAndSet() == -1); // bitmap should be full!
     for (i = 0; i < numBits; i++)
     {
         Clear(i);
     }
+    ASSERT(NumClear() == numBits);
 }
@@ -5,6 +5,11 @@
 //	Represented as an array of unsigned integers, on which we do
 //	modulo arithmetic to find the bit we are interested in.
 //
+//	A second, smaller bitmap summarizes the first: its bit "i" is set
+//	when word "i" of the map still has a clear bit.  Searches skip
+//	whole words of the summary, and then whole words of the map, so
+//	finding a clear bit does not walk the bitmap one bit at a time.
+//
 //	The bitmap can be parameterized with with the number of bits being
 //	managed.
 //
@@ -43,7 +48,16 @@ public:
     int FindAndSet();           // Return the # of a clear bit, and as a side
         // effect, set the bit.
         // If no bits are clear, return -1.
+    int FindAndSetNear(int goal); // Like FindAndSet, but return the
+        // first clear bit from "goal" on, if any.
+    int FindAndSetRun(int length, int goal = 0); // Return the # of the
+        // first of "length" consecutive clear bits from
+        // "goal" on, or else from the start, and set them all.
+        // If there is no such run, return -1.
     int NumClear() const; // Return the number of clear bits
+                          // (kept up to date, so this is free)
+    int NumClear(int from, int count) const; // Return the number of
+                          // clear bits among "count" from "from" on
 
     void Print() const; // Print contents of bitmap
     void SelfTest();    // Test whether bitmap is working
@@ -55,6 +69,24 @@ protected:
                        //  multiple of the number of bits in
                        //  a word)
     unsigned int *map; // bit storage
+
+    void Recount(); // Rebuild the fields below after "map"
+                    // has been overwritten as a whole
+
+private:
+    int numClear;          // number of clear bits
+    unsigned int *summary; // bit "i" set if map[i] has a clear bit
+    int numSummaryWords;
+    int firstSummaryWord;  // no summary word before this one is
+                           // non-zero
+
+    unsigned int ClearBits(int word) const; // Clear bits of map[word], as
+                                            // set bits, ignoring the ones
+                                            // past numBits
+    void UpdateSummary(int word);           // Recompute the summary bit
+                                            // of map[word]
+    int NextWordWithClear(int word) const;  // First word from "word" on
+                                            // with a clear bit, or numWords
 };
 
 #endif // BITMAP_H
@@ -379,6 +379,32 @@ Lseek(int fd, int offset, int whence)
     ASSERT(retVal >= 0);
 }
 
+//----------------------------------------------------------------------
+// Pread
+// 	Read characters from a given location of an open file, without
+//	a separate seek.  Abort if read fails.
+//----------------------------------------------------------------------
+
+void
+Pread(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pread(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
+//----------------------------------------------------------------------
+// Pwrite
+// 	Write characters to a given location of an open file, without
+//	a separate seek.  Abort if write fails.
+//----------------------------------------------------------------------
+
+void
+Pwrite(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pwrite(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
 //----------------------------------------------------------------------
 // Tell
 // 	Report the current location within an open file.
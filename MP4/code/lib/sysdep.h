@@ -49,6 +49,8 @@ extern void Read(int fd, char *buffer, int nBytes);
 extern int ReadPartial(int fd, char *buffer, int nBytes);
 extern void WriteFile(int fd, char *buffer, int nBytes);
 extern void Lseek(int fd, int offset, int whence);
+extern void Pread(int fd, char *buffer, int nBytes, int offset);
+extern void Pwrite(int fd, char *buffer, int nBytes, int offset);
 extern int Tell(int fd);
 extern int Close(int fd);
 extern bool Unlink(char *name);
@@ -114,39 +114,63 @@ PrintSector(bool writing, int sector, char *data)
 //----------------------------------------------------------------------
 
 void Disk::ReadRequest(int sectorNumber, char *data)
+{
+    ReadSectors(sectorNumber, data, 1);
+}
+
+void Disk::WriteRequest(int sectorNumber, char *data)
+{
+    WriteSectors(sectorNumber, data, 1);
+}
+
+//----------------------------------------------------------------------
+// Disk::ReadSectors/WriteSectors
+// 	Simulate a request to read/write a run of consecutive sectors,
+//	with a single transfer to the UNIX file and a single interrupt.
+//	The run costs one seek to its first sector, then the time for
+//	the others to pass under the head.
+//
+//	"sectorNumber" -- the first disk sector to read/write
+//	"data" -- the bytes to be written, the buffer to hold the incoming bytes
+//	"count" -- the number of sectors
+//----------------------------------------------------------------------
+
+void Disk::ReadSectors(int sectorNumber, char *data, int count)
 {
     int ticks = ComputeLatency(sectorNumber, FALSE);
 
     ASSERT(!active); // only one request at a time
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (count > 0) && (sectorNumber + count <= NumSectors));
 
-    DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
+    DEBUG(dbgDisk, "Reading " << count << " sectors from sector " << sectorNumber);
+    Pread(fileno, data, SectorSize * count, SectorSize * sectorNumber + MagicSize);
     if (debug->IsEnabled('d'))
-        PrintSector(FALSE, sectorNumber, data);
+        for (int i = 0; i < count; i++)
+            PrintSector(FALSE, sectorNumber + i, data + i * SectorSize);
 
     active = TRUE;
     UpdateLast(sectorNumber);
+    ticks = RunLatency(sectorNumber, count, ticks);
     kernel->stats->numDiskReads++;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
-void Disk::WriteRequest(int sectorNumber, char *data)
+void Disk::WriteSectors(int sectorNumber, char *data, int count)
 {
     int ticks = ComputeLatency(sectorNumber, TRUE);
 
     ASSERT(!active);
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    ASSERT((sectorNumber >= 0) && (count > 0) && (sectorNumber + count <= NumSectors));
 
-    DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    DEBUG(dbgDisk, "Writing " << count << " sectors to sector " << sectorNumber);
+    Pwrite(fileno, data, SectorSize * count, SectorSize * sectorNumber + MagicSize);
     if (debug->IsEnabled('d'))
-        PrintSector(TRUE, sectorNumber, data);
+        for (int i = 0; i < count; i++)
+            PrintSector(TRUE, sectorNumber + i, data + i * SectorSize);
 
     active = TRUE;
     UpdateLast(sectorNumber);
+    ticks = RunLatency(sectorNumber, count, ticks);
     kernel->stats->numDiskWrites++;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
@@ -222,6 +246,9 @@ int Disk::ModuloDiff(int to, int from)
 //   	read requests to the current track to be satisfied more quickly.
 //   	The contents of the track buffer are discarded after every seek to
 //   	a new track.
+//
+//	The seek time is added to the disk seek statistics, since every
+//	request computes its latency once.
 //----------------------------------------------------------------------
 
 int Disk::ComputeLatency(int newSector, bool writing)
@@ -230,6 +257,8 @@ int Disk::ComputeLatency(int newSector, bool writing)
     int seek = TimeToSeek(newSector, &rotation);
     int timeAfter = kernel->stats->totalTicks + seek + rotation;
 
+    kernel->stats->diskSeekTicks += seek;
+
 #ifndef NOTRACKBUF // turn this on if you don't want the track buffer stuff
     // check if track buffer applies
     if ((writing == FALSE) && (seek == 0) && (((timeAfter - bufferInit) / RotationTime) > ModuloDiff(newSector, bufferInit / RotationTime)))
@@ -245,6 +274,36 @@ int Disk::ComputeLatency(int newSector, bool writing)
     return (seek + rotation + RotationTime);
 }
 
+//----------------------------------------------------------------------
+// Disk::RunLatency
+// 	Return how long a request for a run of sectors takes, given how
+//	long its first sector takes.  Each further sector passes under
+//	the head one rotation slot after the previous one; stepping onto
+//	the next track costs a one-track seek, and starts loading the
+//	track buffer anew.  The head is left over the last sector.
+//
+//	"sectorNumber" -- the first sector of the run, already the last
+//		one recorded by UpdateLast
+//	"count" -- the number of sectors in the run
+//	"ticks" -- the latency of the first sector
+//----------------------------------------------------------------------
+
+int Disk::RunLatency(int sectorNumber, int count, int ticks)
+{
+    for (int i = 1; i < count; i++)
+    {
+        if ((sectorNumber + i) % SectorsPerTrack == 0)
+        {
+            ticks += SeekTime;
+            kernel->stats->diskSeekTicks += SeekTime;
+            bufferInit = kernel->stats->totalTicks + ticks;
+        }
+        ticks += RotationTime;
+    }
+    lastSector = sectorNumber + count - 1;
+    return ticks;
+}
+
 //----------------------------------------------------------------------
 // Disk::UpdateLast
 //   	Keep track of the most recently requested sector.  So we can know
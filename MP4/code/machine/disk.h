@@ -68,6 +68,10 @@ class Disk : public CallBackObj {
     					// the disk and return immediately.
     					// Only one request allowed at a time!
     void WriteRequest(int sectorNumber, char* data);
+    void ReadSectors(int sectorNumber, char* data, int count);
+    void WriteSectors(int sectorNumber, char* data, int count);
+					// Read/write "count" consecutive
+					// sectors in a single request.
 
     void CallBack();			// Invoked when disk request 
 					// finishes. In turn calls, callWhenDone.
@@ -89,6 +93,9 @@ class Disk : public CallBackObj {
     int TimeToSeek(int newSector, int *rotate); // time to get to the new track
     int ModuloDiff(int to, int from);        // # sectors between to and from
     void UpdateLast(int newSector);
+    int RunLatency(int sectorNumber, int count, int ticks);
+					// time to transfer the rest of a run
+					// of sectors after its first one
 };
 
 #endif // DISK_H
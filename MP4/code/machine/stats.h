@@ -30,6 +30,9 @@ class Statistics {
 
     int numDiskReads;		// number of disk read requests
     int numDiskWrites;		// number of disk write requests
+    int numCacheHits;		// number of sectors found in the buffer cache
+    int numCacheMisses;		// number of sectors not found in the buffer cache
+    int diskSeekTicks;		// time the disk head spent moving between tracks
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
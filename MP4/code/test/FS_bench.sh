@@ -0,0 +1,20 @@
+# FS_partIII-style workload for comparing allocation policies: prints the
+# simulated ticks and disk I/O of every command, then their totals
+run() { ../build.linux/nachos "$@" | grep -E "^(Ticks|Disk I/O)" | tee -a bench.log; }
+rm -f bench.log
+run -f
+run -mkdir /t0
+run -mkdir /t1
+run -mkdir /t2
+run -mkdir /t0/aa
+run -mkdir /t1/bb
+for d in /t0 /t0/aa /t1 /t1/bb /t2; do
+	run -cp num_1000.txt $d/f1
+	run -cp num_100.txt $d/f2
+done
+for d in /t0 /t0/aa /t1 /t1/bb /t2; do
+	run -p $d/f1 > /dev/null
+	run -lr $d > /dev/null
+done
+awk '/^Ticks/ { gsub(",", ""); ticks += $3 } /^Disk I\/O/ { gsub(",", ""); reads += $4; writes += $6 }
+	END { print "total ticks " ticks ", disk reads " reads ", disk writes " writes }' bench.log
@@ -15,6 +15,7 @@
 #include "libtest.h"
 #include "string.h"
 #include "synchdisk.h"
+#include "buffercache.h"
 #include "post.h"
 #include "synchconsole.h"
 
@@ -110,6 +111,7 @@ Kernel::Initialize()
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
     synchDisk = new SynchDisk();    //
+    bufferCache = new BufferCache(synchDisk);
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
@@ -153,8 +155,9 @@ Kernel::~Kernel()
     delete machine;
     delete synchConsoleIn;
     delete synchConsoleOut;
-    delete synchDisk;
     delete fileSystem;
+    delete bufferCache;
+    delete synchDisk;
 	
 	// Mp4 mod tag
 	/*
@@ -44,6 +44,7 @@
 #include "main.h"
 #include "filesys.h"
 #include "openfile.h"
+#include "buffercache.h"
 #include "sysdep.h"
 
 // global variables
@@ -371,6 +372,8 @@ int main(int argc, char **argv)
     {
         Print(printFileName);
     }
+    // nothing can be written to disk once Nachos halts
+    kernel->bufferCache->Flush();
 #endif // FILESYS_STUB
 
     // finally, run an initial user program if requested to do so
@@ -198,6 +198,7 @@ void ExceptionHandler(ExceptionType which)
 			DEBUG(dbgAddr, "Program exit\n");
 			val = kernel->machine->ReadRegister(4);
 			cout << "return value:" << val << endl;
+			kernel->bufferCache->Flush();
 			kernel->currentThread->Finish();
 			break;
 		default:
@@ -14,9 +14,11 @@
 #include "kernel.h"
 
 #include "synchconsole.h"
+#include "buffercache.h"
 
 void SysHalt()
 {
+	kernel->bufferCache->Flush();	// the disk is gone once halted
 	kernel->interrupt->Halt();
 }
 
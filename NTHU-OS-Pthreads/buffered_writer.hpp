@@ -0,0 +1,174 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include "thread.hpp"
+#include "queue.hpp"
+#include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_window.hpp"
+#include "telemetry.hpp"
+
+#ifndef BUFFERED_WRITER_HPP
+#define BUFFERED_WRITER_HPP
+
+#define BUFFERED_WRITER_BUFFER_SIZE (1 << 20)
+// the longest line an item can be formatted into
+#define BUFFERED_WRITER_MAX_LINE 64
+
+// A Writer that formats the items into one large buffer by hand and
+// hands it to the kernel with a single write(2) whenever it fills up.
+class BufferedWriter : public Thread {
+public:
+	// constructor
+	BufferedWriter(int expected_lines, std::string output_file, Queue<Item*>* output_queue, int batch_size = 1, ItemPool* pool = nullptr, ReorderWindow* window = nullptr);
+
+	// destructor
+	~BufferedWriter();
+
+	virtual void start() override;
+private:
+	// the expected lines to write,
+	// the writer thread finished after output expected lines of item
+	int expected_lines;
+
+	int fd;
+	// the formatted lines not yet written
+	char* buffer;
+	int buffered;
+
+	Queue<Item*> *output_queue;
+
+	// the maximum number of items taken from the output queue at once
+	int batch_size;
+	Item** batch;
+
+	// where the written items go back to, they are kept if null
+	ItemPool* pool;
+
+	// puts the items back into input order in ordered output mode, may be null
+	ReorderWindow* window;
+
+	// output an item and hand it back to the pool
+	void write(Item* item);
+
+	// append the decimal representation of val
+	void format_number(unsigned long long val);
+
+	// append "key val opcode\n", the same format as operator<<
+	void format(const Item* item);
+
+	// write out everything buffered
+	void flush();
+
+	// the method for pthread to create a writer thread
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+BufferedWriter::BufferedWriter(int expected_lines, std::string output_file, Queue<Item*>* output_queue, int batch_size, ItemPool* pool, ReorderWindow* window)
+	: expected_lines(expected_lines), output_queue(output_queue), batch_size(batch_size), pool(pool), window(window) {
+	fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	buffer = new char [BUFFERED_WRITER_BUFFER_SIZE];
+	buffered = 0;
+	batch = new Item* [batch_size];
+}
+
+BufferedWriter::~BufferedWriter() {
+	flush();
+	if (fd >= 0)
+		close(fd);
+	delete [] buffer;
+	delete [] batch;
+}
+
+void BufferedWriter::start() {
+	create(BufferedWriter::process, (void*)this);
+}
+
+void BufferedWriter::format_number(unsigned long long val) {
+	char digits[20];
+	int n = 0;
+	do {
+		digits[n++] = '0' + val % 10;
+		val /= 10;
+	} while (val > 0);
+
+	while (n > 0)
+		buffer[buffered++] = digits[--n];
+}
+
+void BufferedWriter::format(const Item* item) {
+	if (item->key < 0) {
+		buffer[buffered++] = '-';
+		format_number(-(long long)item->key);
+	} else {
+		format_number(item->key);
+	}
+	buffer[buffered++] = ' ';
+	format_number(item->val);
+	buffer[buffered++] = ' ';
+	buffer[buffered++] = item->opcode;
+	buffer[buffered++] = '\n';
+}
+
+void BufferedWriter::flush() {
+	const char* data = buffer;
+	while (buffered > 0 && fd >= 0) {
+		ssize_t written = ::write(fd, data, buffered);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		data += written;
+		buffered -= written;
+	}
+	buffered = 0;
+}
+
+void BufferedWriter::write(Item* item) {
+	if (buffered + BUFFERED_WRITER_MAX_LINE > BUFFERED_WRITER_BUFFER_SIZE)
+		flush();
+	format(item);
+	if (pool)
+		pool->put(item);
+}
+
+void* BufferedWriter::process(void* arg) {
+	BufferedWriter* writer = (BufferedWriter*)arg;
+	StageCounters* counters = writer->telemetry ? writer->telemetry->register_thread("writer") : nullptr;
+
+	while (writer->expected_lines > 0) {
+		int max = writer->expected_lines < writer->batch_size ? writer->expected_lines : writer->batch_size;
+		int count = writer->output_queue->dequeue_bulk(writer->batch, max);
+		if (counters) {
+			// one clock read covers the whole batch
+			long long now = monotonic_ns();
+			for (int i = 0; i < count; i++) {
+				counters->add_latency(now - writer->batch[i]->born_ns);
+			}
+			counters->add(count, now);
+		}
+
+		for (int i = 0; i < count; i++) {
+			if (writer->window)
+				writer->window->insert(writer->batch[i]);
+			else
+				writer->write(writer->batch[i]);
+		}
+		if (writer->window) {
+			while (Item* item = writer->window->pop()) {
+				writer->write(item);
+			}
+			writer->window->commit();
+		}
+		writer->expected_lines -= count;
+	}
+	writer->flush();
+
+	return nullptr;
+}
+
+#endif // BUFFERED_WRITER_HPP
@@ -0,0 +1,13 @@
+#include <time.h>
+
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+// return a monotonic timestamp in nanoseconds
+inline long long monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#endif // CLOCK_HPP
@@ -0,0 +1,227 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "consumer_controller.hpp"
+#include "item_pool.hpp"
+
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+// The pipeline topology, settable at run time.
+// Every setting can be given on the command line as --name=value, or in a
+// flat JSON object read with --config=file.json, e.g.
+//   {"readers": 2, "producers": 8, "worker_queue_size": 400, "policy": "adaptive"}
+// Later arguments override earlier ones, so --config can be combined with flags.
+class PipelineConfig {
+public:
+	// the number of reader threads, each parsing its own byte range of the input
+	int readers;
+	int producers;
+
+	int reader_queue_size;
+	int worker_queue_size;
+	int writer_queue_size;
+
+	// the consumer controller thresholds in percent of the worker queue size
+	int low_threshold;
+	int high_threshold;
+	// in microseconds
+	int check_period;
+	// CONSUMER_CONTROLLER_PERIODIC or CONSUMER_CONTROLLER_ADAPTIVE, "periodic" or "adaptive"
+	int policy;
+	// the controller keeps at least min_consumers running from the start, and
+	// never more than max_consumers; 0 for no minimum, and for no maximum with
+	// the periodic policy or the number of cores with the adaptive one
+	int min_consumers;
+	int max_consumers;
+
+	// the number of items every stage moves per queue operation
+	int batch_size;
+
+	// the entries of the transform result cache, 0 for no cache
+	int cache_size;
+
+	// none, stage or colocate, see placement.hpp
+	std::string placement;
+
+	// set the setting called name from its text, return false if there is no
+	// such setting or the text is not a valid value for it
+	bool set(std::string name, std::string value);
+
+	// apply the settings of a flat JSON object, return false on any error
+	bool load(std::string file);
+
+	// apply the --name=value and --config=file arguments in argv[first, argc),
+	// return false and print the reason on any error
+	bool parse_args(int argc, char** argv, int first);
+
+	// return why the settings cannot work together, empty if they can
+	std::string validate();
+
+	// return the items the reorder window holds: enough to fill every queue
+	// and batch, plus slack more, so that the worker queue rises above the
+	// controller's high threshold before the window holds back the readers
+	int reorder_window_size(int slack);
+
+	// return the items of the item pool: the reorder window, plus the items
+	// the readers hold in unstamped batches and the ones every thread using
+	// the pool, the readers and the writer, keeps in its cache; so the reader
+	// owning the next sequence number always finds a free item, however far
+	// the other shards run ahead
+	int item_pool_size(int slack);
+private:
+	// parse an integer from 0 to INT_MAX, return false if text is not one
+	static bool parse_int(std::string text, int* out);
+};
+
+// Implementation start
+
+bool PipelineConfig::parse_int(std::string text, int* out) {
+	if (text.empty())
+		return false;
+	char* end;
+	long val = strtol(text.c_str(), &end, 10);
+	if (*end != '\0' || val < 0 || val > INT_MAX)
+		return false;
+	*out = (int)val;
+	return true;
+}
+
+bool PipelineConfig::set(std::string name, std::string value) {
+	if (name == "policy") {
+		if (value == "periodic")
+			policy = CONSUMER_CONTROLLER_PERIODIC;
+		else if (value == "adaptive")
+			policy = CONSUMER_CONTROLLER_ADAPTIVE;
+		else
+			return false;
+		return true;
+	}
+	if (name == "placement") {
+		placement = value;
+		return true;
+	}
+
+	int* field = nullptr;
+	if (name == "readers")
+		field = &readers;
+	else if (name == "producers")
+		field = &producers;
+	else if (name == "reader_queue_size")
+		field = &reader_queue_size;
+	else if (name == "worker_queue_size")
+		field = &worker_queue_size;
+	else if (name == "writer_queue_size")
+		field = &writer_queue_size;
+	else if (name == "low_threshold")
+		field = &low_threshold;
+	else if (name == "high_threshold")
+		field = &high_threshold;
+	else if (name == "check_period")
+		field = &check_period;
+	else if (name == "min_consumers")
+		field = &min_consumers;
+	else if (name == "max_consumers")
+		field = &max_consumers;
+	else if (name == "batch_size")
+		field = &batch_size;
+	else if (name == "cache_size")
+		field = &cache_size;
+
+	return field != nullptr && parse_int(value, field);
+}
+
+bool PipelineConfig::load(std::string file) {
+	std::ifstream ifs(file);
+	if (!ifs)
+		return false;
+	std::stringstream ss;
+	ss << ifs.rdbuf();
+	std::string text = ss.str();
+
+	// a flat object only: the braces around "name": value pairs separated by commas
+	size_t open = text.find('{'), close = text.rfind('}');
+	if (open == std::string::npos || close == std::string::npos || close < open)
+		return false;
+	text = text.substr(open + 1, close - open - 1);
+
+	std::stringstream pairs(text);
+	std::string pair;
+	while (std::getline(pairs, pair, ',')) {
+		size_t colon = pair.find(':');
+		if (colon == std::string::npos) {
+			if (pair.find_first_not_of(" \t\r\n") == std::string::npos)
+				continue;
+			return false;
+		}
+
+		std::string name = pair.substr(0, colon), value = pair.substr(colon + 1);
+		for (std::string* token : {&name, &value}) {
+			size_t first = token->find_first_not_of(" \t\r\n\"");
+			size_t last = token->find_last_not_of(" \t\r\n\"");
+			*token = first == std::string::npos ? "" : token->substr(first, last - first + 1);
+		}
+		if (!set(name, value)) {
+			std::cerr << "invalid setting " << name << ": " << value << " in " << file << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool PipelineConfig::parse_args(int argc, char** argv, int first) {
+	for (int i = first; i < argc; i++) {
+		std::string arg(argv[i]);
+		size_t equal = arg.find('=');
+		if (arg.compare(0, 2, "--") != 0 || equal == std::string::npos) {
+			std::cerr << "expected --name=value, got " << arg << std::endl;
+			return false;
+		}
+
+		std::string name = arg.substr(2, equal - 2), value = arg.substr(equal + 1);
+		if (name == "config") {
+			if (!load(value)) {
+				std::cerr << "cannot load config " << value << std::endl;
+				return false;
+			}
+		} else if (!set(name, value)) {
+			std::cerr << "invalid setting " << name << ": " << value << std::endl;
+			return false;
+		}
+	}
+
+	std::string error = validate();
+	if (!error.empty()) {
+		std::cerr << error << std::endl;
+		return false;
+	}
+	return true;
+}
+
+std::string PipelineConfig::validate() {
+	if (readers < 1 || producers < 1)
+		return "readers and producers must be at least 1";
+	if (reader_queue_size < 1 || worker_queue_size < 1 || writer_queue_size < 1)
+		return "queue sizes must be at least 1";
+	if (low_threshold >= high_threshold || high_threshold > 100)
+		return "thresholds must satisfy low_threshold < high_threshold <= 100";
+	if (check_period < 1 || batch_size < 1)
+		return "check_period and batch_size must be at least 1";
+	if (max_consumers > 0 && min_consumers > max_consumers)
+		return "min_consumers must not exceed max_consumers";
+	return "";
+}
+
+int PipelineConfig::reorder_window_size(int slack) {
+	return reader_queue_size + worker_queue_size + writer_queue_size +
+		(readers + producers) * batch_size + slack;
+}
+
+int PipelineConfig::item_pool_size(int slack) {
+	return reorder_window_size(slack) + readers * batch_size + (readers + 1) * ITEM_POOL_CACHE_SIZE;
+}
+
+#endif // CONFIG_HPP
@@ -1,71 +1,130 @@
 #include <pthread.h>
 #include <stdio.h>
+#include <atomic>
+#include "clock.hpp"
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "telemetry.hpp"
 
 #ifndef CONSUMER_HPP
 #define CONSUMER_HPP
 
+// the work done by a group of consumers, shared by all of them
+struct ConsumerStats {
+	// the number of items transformed
+	std::atomic<long long> processed;
+	// the time spent transforming them in nanoseconds
+	std::atomic<long long> busy_ns;
+
+	ConsumerStats() : processed(0), busy_ns(0) {}
+};
+
 class Consumer : public Thread {
 public:
 	// constructor
-	Consumer(TSQueue<Item*>* worker_queue, TSQueue<Item*>* output_queue, Transformer* transformer);
+	Consumer(Queue<Item*>* worker_queue, Queue<Item*>* output_queue, Transformer* transformer, int batch_size = 1, ConsumerStats* stats = nullptr);
 
 	// destructor
 	~Consumer();
 
 	virtual void start() override;
 
-	virtual int cancel() override;
+	// whether the consumer took a poison pill and stopped, join() it then
+	bool has_finished();
 private:
-	TSQueue<Item*>* worker_queue;
-	TSQueue<Item*>* output_queue;
+	Queue<Item*>* worker_queue;
+	Queue<Item*>* output_queue;
 
 	Transformer* transformer;
 
-	bool is_cancel;
+	// the maximum number of items taken from the worker queue at once
+	int batch_size;
+	Item** batch;
+	// the opcodes and values of the batch, transformed together
+	char* opcodes;
+	unsigned long long* vals;
+
+	// where to account the work done, may be null
+	ConsumerStats* stats;
+
+	std::atomic<bool> finished;
 
 	// the method for pthread to create a consumer thread
 	static void* process(void* arg);
 };
 
-Consumer::Consumer(TSQueue<Item*>* worker_queue, TSQueue<Item*>* output_queue, Transformer* transformer)
-	: worker_queue(worker_queue), output_queue(output_queue), transformer(transformer) {
-	is_cancel = false;
+Consumer::Consumer(Queue<Item*>* worker_queue, Queue<Item*>* output_queue, Transformer* transformer, int batch_size, ConsumerStats* stats)
+	: worker_queue(worker_queue), output_queue(output_queue), transformer(transformer), batch_size(batch_size), stats(stats) {
+	finished.store(false);
+	batch = new Item* [batch_size];
+	opcodes = new char [batch_size];
+	vals = new unsigned long long [batch_size];
 }
 
-Consumer::~Consumer() {}
+Consumer::~Consumer() {
+	delete [] batch;
+	delete [] opcodes;
+	delete [] vals;
+}
 
 void Consumer::start() {
 	// TODO: starts a Consumer thread
-	pthread_create(&t, 0, Consumer::process, (void*)this);
+	create(Consumer::process, (void*)this);
 }
 
-int Consumer::cancel() {
-	// TODO: cancels the consumer thread
-	is_cancel = true;
-	return pthread_cancel(this->t);
+bool Consumer::has_finished() {
+	return finished.load();
 }
 
 void* Consumer::process(void* arg) {
 	Consumer* consumer = (Consumer*)arg;
+	StageCounters* counters = consumer->telemetry ? consumer->telemetry->register_thread("consumer") : nullptr;
 
-	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, nullptr);
-
-	while (!consumer->is_cancel) {
-		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
-
+	while (true) {
 		// TODO: implements the Consumer's work
-		Item* item = consumer->worker_queue->dequeue();
-		item->val = consumer->transformer->consumer_transform(item->opcode, item->val);
-		consumer->output_queue->enqueue(item);
-
-		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+		int count = consumer->worker_queue->dequeue_bulk(consumer->batch, consumer->batch_size);
+		long long begin = consumer->stats ? monotonic_ns() : 0;
+
+		// a null item is a poison pill asking one consumer to retire; the
+		// real items of the batch are still transformed and handed on
+		int live = 0, pills = 0;
+		for (int i = 0; i < count; i++) {
+			Item* item = consumer->batch[i];
+			if (item == nullptr) {
+				pills++;
+				continue;
+			}
+			consumer->opcodes[live] = item->opcode;
+			consumer->vals[live] = item->val;
+			consumer->batch[live++] = item;
+		}
+
+		// the items sharing an opcode are transformed side by side
+		consumer->transformer->consumer_transform_batch(consumer->opcodes, consumer->vals, live);
+		for (int i = 0; i < live; i++) {
+			consumer->batch[i]->val = consumer->vals[i];
+		}
+		if (consumer->stats) {
+			consumer->stats->busy_ns += monotonic_ns() - begin;
+			consumer->stats->processed += live;
+		}
+		if (live > 0)
+			consumer->output_queue->enqueue_bulk(consumer->batch, live);
+		if (counters && live > 0)
+			counters->add(live, monotonic_ns());
+
+		if (pills > 0) {
+			// the other pills of the batch are meant for other consumers
+			for (int i = 1; i < pills; i++) {
+				consumer->worker_queue->enqueue(nullptr);
+			}
+			break;
+		}
 	}
 
-	delete consumer;
+	consumer->finished.store(true);
 
 	return nullptr;
 }
@@ -1,25 +1,39 @@
 #include <pthread.h>
 #include <unistd.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
 #include <vector>
 #include <iostream>
+#include "clock.hpp"
 #include "consumer.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "placement.hpp"
 
 #ifndef CONSUMER_CONTROLLER
 #define CONSUMER_CONTROLLER
 
-class ConsumerController : public Thread {
+// move by one consumer per check period according to the thresholds
+#define CONSUMER_CONTROLLER_PERIODIC 0
+// react to watermark crossings and size the pool from the measured rates
+#define CONSUMER_CONTROLLER_ADAPTIVE 1
+
+class ConsumerController : public Thread, public QueueListener {
 public:
 	// constructor
 	ConsumerController(
-		TSQueue<Item*>* worker_queue,
-		TSQueue<Item*>* writer_queue,
+		Queue<Item*>* worker_queue,
+		Queue<Item*>* writer_queue,
 		Transformer* transformer,
 		int check_period,
 		int low_threshold,
-		int high_threshold
+		int high_threshold,
+		int batch_size = 1,
+		int policy = CONSUMER_CONTROLLER_PERIODIC,
+		int max_consumers = 0,
+		int min_consumers = 0
 	);
 
 	// destructor
@@ -27,78 +41,368 @@ public:
 
 	virtual void start();
 
+	// wakes up the adaptive controller, called by the worker queue
+	virtual void watermark_crossed(int size) override;
+
+	// pin the consumers where placement puts them, call before start()
+	void set_placement(Placement* placement);
+
+	// retire all consumers and stop controlling, join() to wait for all of them
+	void stop();
+
 private:
+	// the consumers still running, including the retiring ones
 	std::vector<Consumer*> consumers;
+	// the worker queue lane, and the slot placement pins it to, of every consumer
+	std::vector<int> consumer_lanes;
+	// the lanes of the reaped consumers, free to be given out again, and the
+	// number of lanes given out so far; consumers retire in any order, so a
+	// new one takes a free lane rather than the one numbered by the active count
+	std::vector<int> free_lanes;
+	int lanes_used;
+	// the poison pills sent to the worker queue that no consumer has acted on yet
+	int retiring;
 
-	TSQueue<Item*>* worker_queue;
-	TSQueue<Item*>* writer_queue;
+	Queue<Item*>* worker_queue;
+	Queue<Item*>* writer_queue;
 
 	Transformer* transformer;
 
 	// Check to scale down or scale up every check period in microseconds.
 	int check_period;
+	// The worker queue size counts the items in all of its lanes, if it has lanes.
 	// When the number of items in the worker queue is lower than low_threshold,
 	// the number of consumers scaled down by 1.
 	int low_threshold;
 	// When the number of items in the worker queue is higher than high_threshold,
 	// the number of consumers scaled up by 1.
 	int high_threshold;
+	// the batch size given to every consumer
+	int batch_size;
+
+	// CONSUMER_CONTROLLER_PERIODIC or CONSUMER_CONTROLLER_ADAPTIVE
+	int policy;
+	// never run more consumers than this; 0 leaves the periodic policy
+	// uncapped and caps the adaptive one at the core count
+	int max_consumers;
+	// run this many consumers from the start and never scale below them
+	int min_consumers;
+
+	// where the consumers run, may be null
+	Placement* placement;
+
+	// the work done by all consumers, sampled by the adaptive policy
+	ConsumerStats stats;
+
+	// set by watermark_crossed and stop, guarded by mutex
+	bool crossed;
+	bool stopped;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	// the number of consumers not asked to retire
+	int active();
+
+	// the fewest and the most active consumers the policy may settle on
+	int lower_bound();
+	int upper_bound();
+
+	// add or retire consumers until there are target active ones
+	void scale_to(int target);
+
+	// send n poison pills through the worker queue, each retires one consumer
+	void retire(int n);
+
+	// join and delete the consumers that have retired, if wait is set block
+	// until all of them have
+	void reap(bool wait);
+
+	// wait for a watermark crossing or at most one check period,
+	// return false once stop() was called
+	bool wait_for_event();
+
+	// retire every consumer and wait for them when the controller stops
+	void shutdown();
 
 	static void* process(void* arg);
+
+	static void* adaptive_process(void* arg);
 };
 
 // Implementation start
 
 ConsumerController::ConsumerController(
-	TSQueue<Item*>* worker_queue,
-	TSQueue<Item*>* writer_queue,
+	Queue<Item*>* worker_queue,
+	Queue<Item*>* writer_queue,
 	Transformer* transformer,
 	int check_period,
 	int low_threshold,
-	int high_threshold
+	int high_threshold,
+	int batch_size,
+	int policy,
+	int max_consumers,
+	int min_consumers
 ) : worker_queue(worker_queue),
 	writer_queue(writer_queue),
 	transformer(transformer),
 	check_period(check_period),
 	low_threshold(low_threshold),
-	high_threshold(high_threshold) {
+	high_threshold(high_threshold),
+	batch_size(batch_size),
+	policy(policy),
+	max_consumers(max_consumers),
+	min_consumers(min_consumers) {
+	placement = nullptr;
+	retiring = 0;
+	lanes_used = 0;
+	crossed = false;
+	stopped = false;
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond, NULL);
 }
 
-ConsumerController::~ConsumerController() {}
+ConsumerController::~ConsumerController() {
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond);
+}
 
 void ConsumerController::start() {
 	// TODO: starts a ConsumerController thread
-	pthread_create(&t, 0, ConsumerController::process, (void*)this);
+	if (policy == CONSUMER_CONTROLLER_ADAPTIVE) {
+		worker_queue->set_watermarks(low_threshold, high_threshold, this);
+		create(ConsumerController::adaptive_process, (void*)this);
+	} else {
+		create(ConsumerController::process, (void*)this);
+	}
+}
+
+void ConsumerController::watermark_crossed(int size) {
+	pthread_mutex_lock(&mutex);
+	crossed = true;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+void ConsumerController::set_placement(Placement* placement) {
+	this->placement = placement;
+}
+
+void ConsumerController::stop() {
+	pthread_mutex_lock(&mutex);
+	stopped = true;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+int ConsumerController::active() {
+	return consumers.size() - retiring;
+}
+
+int ConsumerController::lower_bound() {
+	return min_consumers > 1 ? min_consumers : 1;
+}
+
+int ConsumerController::upper_bound() {
+	if (max_consumers > 0)
+		return max_consumers;
+	if (policy == CONSUMER_CONTROLLER_ADAPTIVE)
+		return sysconf(_SC_NPROCESSORS_ONLN);
+	return INT_MAX;
+}
+
+void ConsumerController::retire(int n) {
+	// whichever consumer dequeues a pill finishes its batch and exits, so
+	// retiring costs the consumers nothing until it actually happens
+	for (int i = 0; i < n; i++) {
+		worker_queue->enqueue(nullptr);
+	}
+	retiring += n;
+}
+
+void ConsumerController::reap(bool wait) {
+	for (size_t i = 0; i < consumers.size(); ) {
+		if (wait || consumers[i]->has_finished()) {
+			consumers[i]->join();
+			delete consumers[i];
+			consumers.erase(consumers.begin() + i);
+			free_lanes.push_back(consumer_lanes[i]);
+			consumer_lanes.erase(consumer_lanes.begin() + i);
+			retiring--;
+		} else {
+			i++;
+		}
+	}
+}
+
+void ConsumerController::shutdown() {
+	retire(active());
+	reap(true);
+}
+
+void ConsumerController::scale_to(int target) {
+	int curr = active();
+
+	if (target < curr) {
+		std::cout << "Scaling down consumers from " << curr << " to " << target << std::endl;
+
+		retire(curr - target);
+	} else if (target > curr) {
+		std::cout << "Scaling up consumers from " << curr << " to " << target << std::endl;
+
+		while (active() < target) {
+			int id;
+			if (free_lanes.empty()) {
+				id = lanes_used++;
+			} else {
+				id = free_lanes.back();
+				free_lanes.pop_back();
+			}
+
+			// every consumer drains its own lane of the worker queue, if it has lanes
+			Queue<Item*>* lane = worker_queue->lane(id);
+			ConsumerStats* consumer_stats = policy == CONSUMER_CONTROLLER_ADAPTIVE ? &stats : nullptr;
+			Consumer* newConsumer = new Consumer(lane, writer_queue, transformer, batch_size, consumer_stats);
+			newConsumer->set_telemetry(telemetry);
+			if (placement)
+				newConsumer->set_cpu(placement->cpu_for("consumer", id));
+			consumers.push_back(newConsumer);
+			consumer_lanes.push_back(id);
+			newConsumer->start();
+		}
+	}
+}
+
+bool ConsumerController::wait_for_event() {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += check_period / 1000000;
+	deadline.tv_nsec += (check_period % 1000000) * 1000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&mutex);
+	while (!crossed && !stopped) {
+		if (pthread_cond_timedwait(&cond, &mutex, &deadline) != 0)
+			break;
+	}
+	crossed = false;
+	bool running = !stopped;
+	pthread_mutex_unlock(&mutex);
+
+	return running;
 }
 
 void* ConsumerController::process(void* arg) {
 	// TODO: implements the ConsumerController's work
 	ConsumerController* consumer_controller = (ConsumerController*)arg;
+	consumer_controller->scale_to(consumer_controller->min_consumers);
 
 	while (true) {
+		consumer_controller->reap(false);
 		int curr_size = consumer_controller->worker_queue->get_size();
 
 		if (curr_size < consumer_controller->low_threshold) {
-			if (consumer_controller->consumers.size() > 1) {
-				std::cout << "Scaling down consumers from " << consumer_controller->consumers.size() << " to " << consumer_controller->consumers.size()-1 << std::endl;
-
-				Consumer* to_delete = consumer_controller->consumers.back();
-				consumer_controller->consumers.pop_back();
-				to_delete->cancel();
+			if (consumer_controller->active() > consumer_controller->lower_bound()) {
+				consumer_controller->scale_to(consumer_controller->active() - 1);
 			}
 		}
 		else if (curr_size > consumer_controller->high_threshold) {
-			std::cout << "Scaling up consumers from " << consumer_controller->consumers.size() << " to " << consumer_controller->consumers.size()+1 << std::endl;
+			if (consumer_controller->active() < consumer_controller->upper_bound()) {
+				consumer_controller->scale_to(consumer_controller->active() + 1);
+			}
+		}
 
-			Consumer* newConsumer = new Consumer(consumer_controller->worker_queue, consumer_controller->writer_queue, consumer_controller->transformer);
-			consumer_controller->consumers.push_back(newConsumer);
-			newConsumer->start();
+		// Check periodically in microsecond (us), unless stopped
+		if (!consumer_controller->wait_for_event())
+			break;
+	}
+
+	consumer_controller->shutdown();
+
+	return nullptr;
+}
+
+void* ConsumerController::adaptive_process(void* arg) {
+	ConsumerController* consumer_controller = (ConsumerController*)arg;
+	consumer_controller->scale_to(consumer_controller->min_consumers);
+	Queue<Item*>* worker_queue = consumer_controller->worker_queue;
+	ConsumerStats* stats = &consumer_controller->stats;
+	double period = consumer_controller->check_period / 1e6;
+
+	long long last_ns = monotonic_ns();
+	long long last_dequeued = worker_queue->get_dequeued();
+	long long last_processed = 0, last_busy_ns = 0;
+	int last_size = worker_queue->get_size();
+
+	// smoothed items/sec entering the worker queue, and handled by one busy consumer
+	double arrival_rate = 0, service_rate = 0;
+
+	while (true) {
+		consumer_controller->reap(false);
+		long long now = monotonic_ns();
+		long long dequeued = worker_queue->get_dequeued();
+		long long processed = stats->processed.load();
+		long long busy_ns = stats->busy_ns.load();
+		int curr_size = worker_queue->get_size();
+		int curr = consumer_controller->active();
+
+		// weigh every sample by how much of a check period it covers, so that
+		// the short windows between back-to-back crossings do not dominate
+		double elapsed = (now - last_ns) / 1e9;
+		double weight = elapsed / period < 1 ? elapsed / period : 1;
+		if (elapsed > 0) {
+			double arrived = dequeued - last_dequeued + curr_size - last_size;
+			arrival_rate += weight * (arrived / elapsed - arrival_rate);
+		}
+		if (busy_ns > last_busy_ns && processed > last_processed) {
+			// the per-item latency of a consumer gives its service rate
+			double latency = (busy_ns - last_busy_ns) / 1e9 / (processed - last_processed);
+			double sample = 1 / latency;
+			service_rate = service_rate == 0 ? sample : service_rate + weight * (sample - service_rate);
+		}
+
+		int target = curr;
+		if (service_rate == 0) {
+			// nothing measured yet, start the way the periodic policy does
+			if (curr_size > consumer_controller->high_threshold)
+				target = curr + 1;
+		} else {
+			// keep up with the arrivals and drain the backlog above the low
+			// threshold within one check period
+			int backlog = curr_size > consumer_controller->low_threshold ? curr_size - consumer_controller->low_threshold : 0;
+			target = (int)ceil((arrival_rate + backlog / period) / service_rate);
+
+			// only shrink once the queue is no longer above the high threshold,
+			// and only grow while it is above the low one
+			if (target < curr && curr_size > consumer_controller->high_threshold)
+				target = curr;
+			if (target > curr && curr_size < consumer_controller->low_threshold)
+				target = curr;
 		}
-		
-		// Check periodically in microsecond (us)
-		usleep(consumer_controller->check_period);
+
+		if (target > consumer_controller->upper_bound())
+			target = consumer_controller->upper_bound();
+		if (target < consumer_controller->min_consumers)
+			target = consumer_controller->min_consumers;
+		if (target < 1 && curr > 0)
+			target = 1;
+
+		consumer_controller->scale_to(target);
+
+		last_ns = now;
+		last_dequeued = dequeued;
+		last_processed = processed;
+		last_busy_ns = busy_ns;
+		last_size = curr_size;
+
+		if (!consumer_controller->wait_for_event())
+			break;
 	}
 
+	consumer_controller->shutdown();
+
 	return nullptr;
 }
 
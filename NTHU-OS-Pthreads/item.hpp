@@ -15,6 +15,12 @@ public:
 	int key;
 	unsigned long long val;
 	char opcode;
+
+	// the position of the item in the input, only set in ordered output mode
+	long long seq;
+
+	// when the reader read the item, only set when telemetry is on
+	long long born_ns;
 };
 
 // Implementation start
@@ -22,7 +28,7 @@ public:
 Item::Item() {}
 
 Item::Item(int key, unsigned long long val, char opcode) :
-	key(key), val(val), opcode(opcode) {
+	key(key), val(val), opcode(opcode), seq(0), born_ns(0) {
 }
 
 Item::~Item() {}
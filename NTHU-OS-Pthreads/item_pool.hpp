@@ -0,0 +1,143 @@
+#include <assert.h>
+#include <pthread.h>
+#include "item.hpp"
+
+#ifndef ITEM_POOL_HPP
+#define ITEM_POOL_HPP
+
+// the most free items a thread keeps for itself
+#define ITEM_POOL_CACHE_SIZE 64
+
+// A fixed number of Items allocated up front in one slab.
+// Every thread keeps a small cache of free items, so get() and put() only
+// take the pool lock once per ITEM_POOL_CACHE_SIZE / 2 items. When all items
+// are in use get() blocks until one is returned, which bounds the memory of
+// the pipeline no matter how long the input is.
+class ItemPool {
+public:
+	// constructor
+	explicit ItemPool(int capacity);
+
+	// destructor
+	~ItemPool();
+
+	// take a free item, block until one is returned if all of them are in use
+	Item* get();
+
+	// give back an item taken with get()
+	void put(Item* item);
+private:
+	struct Cache {
+		// the pool the cached items belong to
+		ItemPool* pool;
+		int count;
+		Item* items[ITEM_POOL_CACHE_SIZE];
+	};
+
+	// the cache of the calling thread
+	static Cache* local_cache();
+
+	int capacity;
+	// all the items of the pool
+	Item* slab;
+
+	// the free items not cached by any thread, guarded by mutex
+	Item** free_items;
+	int free_count;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_free;
+
+	// move up to n free items into out, block until there is at least one
+	int take(Item** out, int n);
+
+	// move n items back to the free list
+	void give(Item** items, int n);
+};
+
+// Implementation start
+
+ItemPool::ItemPool(int capacity) : capacity(capacity) {
+	// a thread may keep a full cache, so smaller pools could run dry for good
+	assert(capacity >= ITEM_POOL_CACHE_SIZE);
+
+	slab = new Item [capacity];
+	free_items = new Item* [capacity];
+	for (int i = 0; i < capacity; i++) {
+		free_items[i] = &slab[i];
+	}
+	free_count = capacity;
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond_free, NULL);
+}
+
+ItemPool::~ItemPool() {
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_free);
+	delete [] free_items;
+	delete [] slab;
+}
+
+ItemPool::Cache* ItemPool::local_cache() {
+	static thread_local Cache cache;
+	return &cache;
+}
+
+int ItemPool::take(Item** out, int n) {
+	pthread_mutex_lock(&mutex);
+	while (free_count == 0) {
+		pthread_cond_wait(&cond_free, &mutex);
+	}
+
+	int count = free_count < n ? free_count : n;
+	for (int i = 0; i < count; i++) {
+		out[i] = free_items[--free_count];
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return count;
+}
+
+void ItemPool::give(Item** items, int n) {
+	pthread_mutex_lock(&mutex);
+	for (int i = 0; i < n; i++) {
+		free_items[free_count++] = items[i];
+	}
+	pthread_cond_broadcast(&cond_free);
+	pthread_mutex_unlock(&mutex);
+}
+
+Item* ItemPool::get() {
+	Cache* cache = local_cache();
+	if (cache->count > 0 && cache->pool != this) {
+		// the thread caches items of another pool, leave them alone
+		Item* item;
+		take(&item, 1);
+		return item;
+	}
+
+	cache->pool = this;
+	if (cache->count == 0) {
+		cache->count = take(cache->items, ITEM_POOL_CACHE_SIZE / 2);
+	}
+	return cache->items[--cache->count];
+}
+
+void ItemPool::put(Item* item) {
+	Cache* cache = local_cache();
+	if (cache->count > 0 && cache->pool != this) {
+		give(&item, 1);
+		return;
+	}
+
+	cache->pool = this;
+	if (cache->count == ITEM_POOL_CACHE_SIZE) {
+		// keep half of the cache for the next puts, return the rest
+		cache->count -= ITEM_POOL_CACHE_SIZE / 2;
+		give(cache->items + cache->count, ITEM_POOL_CACHE_SIZE / 2);
+	}
+	cache->items[cache->count++] = item;
+}
+
+#endif // ITEM_POOL_HPP
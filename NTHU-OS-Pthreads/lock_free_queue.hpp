@@ -0,0 +1,299 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <atomic>
+#include "queue.hpp"
+
+#ifndef LOCK_FREE_QUEUE_HPP
+#define LOCK_FREE_QUEUE_HPP
+
+#ifndef DEFAULT_BUFFER_SIZE
+#define DEFAULT_BUFFER_SIZE 200
+#endif
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+// the number of failed attempts before a blocked caller yields its core
+#define LOCK_FREE_QUEUE_SPIN_LIMIT 64
+// the number of times it yields before it goes to sleep
+#define LOCK_FREE_QUEUE_YIELD_LIMIT 16
+
+// A bounded multi-producer/multi-consumer queue without locks.
+// Every slot carries a sequence number telling whether it is ready to be
+// written (sequence == pos) or read (sequence == pos + 1) by the caller
+// that claimed position pos, so producers and consumers only contend on
+// the head or tail counter with a single compare-and-swap.
+// A caller that finds the queue full (or empty) spins and yields for a while,
+// then sleeps on a condition variable until the other side makes progress.
+template <class T>
+class LockFreeQueue : public Queue<T> {
+public:
+	// constructor
+	LockFreeQueue();
+
+	explicit LockFreeQueue(int max_buffer_size);
+
+	// destructor
+	~LockFreeQueue();
+
+	// add an element to the end of the queue
+	virtual void enqueue(T item) override;
+
+	// remove and return the first element of the queue
+	virtual T dequeue() override;
+
+	// add n elements to the end of the queue
+	virtual void enqueue_bulk(T* items, int n) override;
+
+	// remove up to max elements from the queue into out
+	virtual int dequeue_bulk(T* out, int max) override;
+
+	// return the number of elements in the queue
+	virtual int get_size() override;
+
+	// try to add an element without waiting, return false if the queue is full
+	bool try_enqueue(T item);
+
+	// try to remove an element without waiting, return false if the queue is empty
+	bool try_dequeue(T& item);
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	// the maximum buffer size
+	size_t buffer_size;
+	// the buffer containing values of the queue
+	Slot* buffer;
+
+	// the position of the next item to dequeue, kept on its own cache line
+	char pad0[CACHE_LINE_SIZE];
+	std::atomic<size_t> head;
+	// the position of the next item to enqueue, kept on its own cache line
+	char pad1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> tail;
+	char pad2[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+	// blocked enqueuers and dequeuers sleep here; the waiter counters let the
+	// fast path skip the mutex when nobody is sleeping
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_enqueue, cond_dequeue;
+	std::atomic<int> enqueue_waiters, dequeue_waiters;
+
+	// back off after spin failed attempts, return false once the caller
+	// should stop spinning and sleep
+	static bool backoff(int& spin);
+
+	// whether the next enqueue (or dequeue) would fail, without claiming anything
+	bool is_full();
+	bool is_empty();
+
+	void wake(pthread_cond_t* cond, std::atomic<int>& waiters);
+};
+
+// Implementation start
+
+template <class T>
+LockFreeQueue<T>::LockFreeQueue() : LockFreeQueue(DEFAULT_BUFFER_SIZE) {
+}
+
+template <class T>
+LockFreeQueue<T>::LockFreeQueue(int buffer_size) : buffer_size(buffer_size) {
+	buffer = new Slot [buffer_size];
+	for (size_t i = 0; i < this->buffer_size; i++) {
+		buffer[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	head.store(0, std::memory_order_relaxed);
+	tail.store(0, std::memory_order_relaxed);
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond_enqueue, NULL);
+	pthread_cond_init(&cond_dequeue, NULL);
+	enqueue_waiters.store(0);
+	dequeue_waiters.store(0);
+}
+
+template <class T>
+LockFreeQueue<T>::~LockFreeQueue() {
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_enqueue);
+	pthread_cond_destroy(&cond_dequeue);
+	delete [] buffer;
+}
+
+template <class T>
+bool LockFreeQueue<T>::try_enqueue(T item) {
+	size_t pos = tail.load(std::memory_order_relaxed);
+
+	while (true) {
+		Slot* slot = &buffer[pos % buffer_size];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		long diff = (long)sequence - (long)pos;
+
+		if (diff == 0) {
+			// the slot is free, try to claim it
+			if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				slot->data = item;
+				slot->sequence.store(pos + 1, std::memory_order_release);
+				// reading the size touches the head too, so only when someone
+				// watches it; it is only a snapshot, good enough for watermarks
+				if (this->size_watched()) {
+					int curr_size = get_size();
+					this->size_changed(curr_size - 1, curr_size);
+				}
+				wake(&cond_dequeue, dequeue_waiters);
+				return true;
+			}
+		} else if (diff < 0) {
+			// the slot still holds an item from the previous lap, the queue is full
+			return false;
+		} else {
+			// another producer claimed this position, retry from the new tail
+			pos = tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <class T>
+bool LockFreeQueue<T>::try_dequeue(T& item) {
+	size_t pos = head.load(std::memory_order_relaxed);
+
+	while (true) {
+		Slot* slot = &buffer[pos % buffer_size];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		long diff = (long)sequence - (long)(pos + 1);
+
+		if (diff == 0) {
+			// the slot is filled, try to claim it
+			if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				item = slot->data;
+				slot->sequence.store(pos + buffer_size, std::memory_order_release);
+				if (this->size_watched()) {
+					int curr_size = get_size();
+					this->size_changed(curr_size + 1, curr_size);
+				}
+				wake(&cond_enqueue, enqueue_waiters);
+				return true;
+			}
+		} else if (diff < 0) {
+			// the slot has not been filled yet, the queue is empty
+			return false;
+		} else {
+			// another consumer claimed this position, retry from the new head
+			pos = head.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <class T>
+bool LockFreeQueue<T>::backoff(int& spin) {
+	if (++spin % LOCK_FREE_QUEUE_SPIN_LIMIT == 0)
+		sched_yield();
+	return spin < LOCK_FREE_QUEUE_SPIN_LIMIT * LOCK_FREE_QUEUE_YIELD_LIMIT;
+}
+
+template <class T>
+void LockFreeQueue<T>::wake(pthread_cond_t* cond, std::atomic<int>& waiters) {
+	// a waiter registers itself before checking the queue again, so either it
+	// sees the slot we just published or we see it and broadcast after it went
+	// to sleep; the fence keeps the slot store from passing the counter load
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiters.load(std::memory_order_relaxed) > 0) {
+		pthread_mutex_lock(&mutex);
+		pthread_cond_broadcast(cond);
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+template <class T>
+bool LockFreeQueue<T>::is_full() {
+	size_t pos = tail.load(std::memory_order_seq_cst);
+	size_t sequence = buffer[pos % buffer_size].sequence.load(std::memory_order_seq_cst);
+	return (long)sequence - (long)pos < 0;
+}
+
+template <class T>
+bool LockFreeQueue<T>::is_empty() {
+	size_t pos = head.load(std::memory_order_seq_cst);
+	size_t sequence = buffer[pos % buffer_size].sequence.load(std::memory_order_seq_cst);
+	return (long)sequence - (long)(pos + 1) < 0;
+}
+
+template <class T>
+void LockFreeQueue<T>::enqueue(T item) {
+	int spin = 0;
+	long long wait = 0;
+	while (!try_enqueue(item)) {
+		if (!wait)
+			wait = this->wait_begin();
+		if (backoff(spin))
+			continue;
+
+		pthread_mutex_lock(&mutex);
+		enqueue_waiters++;
+		while (is_full()) {
+			pthread_cond_wait(&cond_enqueue, &mutex);
+		}
+		enqueue_waiters--;
+		pthread_mutex_unlock(&mutex);
+	}
+	this->enqueue_wait_end(wait);
+}
+
+template <class T>
+T LockFreeQueue<T>::dequeue() {
+	T item;
+	int spin = 0;
+	long long wait = 0;
+	while (!try_dequeue(item)) {
+		if (!wait)
+			wait = this->wait_begin();
+		if (backoff(spin))
+			continue;
+
+		pthread_mutex_lock(&mutex);
+		dequeue_waiters++;
+		while (is_empty()) {
+			pthread_cond_wait(&cond_dequeue, &mutex);
+		}
+		dequeue_waiters--;
+		pthread_mutex_unlock(&mutex);
+	}
+	this->dequeue_wait_end(wait);
+	return item;
+}
+
+template <class T>
+void LockFreeQueue<T>::enqueue_bulk(T* items, int n) {
+	for (int i = 0; i < n; i++) {
+		enqueue(items[i]);
+	}
+}
+
+template <class T>
+int LockFreeQueue<T>::dequeue_bulk(T* out, int max) {
+	// wait for the first element only, then take whatever else is ready
+	out[0] = dequeue();
+
+	int count = 1;
+	while (count < max && try_dequeue(out[count])) {
+		count++;
+	}
+	return count;
+}
+
+template <class T>
+int LockFreeQueue<T>::get_size() {
+	size_t curr_head = head.load(std::memory_order_relaxed);
+	size_t curr_tail = tail.load(std::memory_order_relaxed);
+
+	// both counters may move while being read, clamp into a valid size
+	if (curr_tail <= curr_head)
+		return 0;
+	if (curr_tail - curr_head > buffer_size)
+		return buffer_size;
+	return curr_tail - curr_head;
+}
+
+#endif // LOCK_FREE_QUEUE_HPP
@@ -1,18 +1,130 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <vector>
 #include "ts_queue.hpp"
+#include "lock_free_queue.hpp"
+#include "work_stealing_queue.hpp"
 #include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_window.hpp"
 #include "reader.hpp"
 #include "writer.hpp"
+#include "mapped_reader.hpp"
+#include "sharded_reader.hpp"
+#include "buffered_writer.hpp"
 #include "producer.hpp"
 #include "consumer_controller.hpp"
+#include "telemetry.hpp"
+#include "placement.hpp"
+#include "config.hpp"
+#include "clock.hpp"
 
+// every setting below can be overridden at build time with -DNAME=value;
+// the ones with a PipelineConfig counterpart are only defaults, see config.hpp
+// for how to set them at run time
+#ifndef READER_QUEUE_SIZE
 #define READER_QUEUE_SIZE 200
+#endif
+#ifndef WORKER_QUEUE_SIZE
 #define WORKER_QUEUE_SIZE 200
+#endif
+#ifndef WRITER_QUEUE_SIZE
 #define WRITER_QUEUE_SIZE 4000
+#endif
+#ifndef CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE
 #define CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE 20
+#endif
+#ifndef CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE
 #define CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE 80
+#endif
+#ifndef CONSUMER_CONTROLLER_CHECK_PERIOD
 #define CONSUMER_CONTROLLER_CHECK_PERIOD 1000000
+#endif
+// CONSUMER_CONTROLLER_PERIODIC or CONSUMER_CONTROLLER_ADAPTIVE
+#ifndef CONSUMER_CONTROLLER_POLICY
+#define CONSUMER_CONTROLLER_POLICY CONSUMER_CONTROLLER_PERIODIC
+#endif
+// the most consumers the controller may run; 0 leaves the periodic policy
+// uncapped and caps the adaptive one at the number of cores
+#ifndef CONSUMER_CONTROLLER_MAX_CONSUMERS
+#define CONSUMER_CONTROLLER_MAX_CONSUMERS 0
+#endif
+// the consumers started right away, which the controller never scales below
+#ifndef CONSUMER_CONTROLLER_MIN_CONSUMERS
+#define CONSUMER_CONTROLLER_MIN_CONSUMERS 0
+#endif
+// set to 1 to connect the stages with LockFreeQueue instead of TSQueue
+#ifndef USE_LOCK_FREE_QUEUE
+#define USE_LOCK_FREE_QUEUE 0
+#endif
+// the most iterations a TSQueue caller spins before it blocks, 0 to block right away;
+// every queue tunes its own budget below this from how often spinning succeeds
+#ifndef QUEUE_SPIN_LIMIT
+#define QUEUE_SPIN_LIMIT 2000
+#endif
+// set to 1 to give every consumer its own lane of the worker queue, with work
+// stealing; off by default, since every operation still updates the counters
+// shared by all lanes and so is no cheaper than the single queue
+#ifndef USE_WORK_STEALING
+#define USE_WORK_STEALING 0
+#endif
+#ifndef WORKER_QUEUE_LANES
+#define WORKER_QUEUE_LANES 8
+#endif
+// the number of items every stage moves per queue operation
+#ifndef BATCH_SIZE
+#define BATCH_SIZE 16
+#endif
+// set to 1 to replace the transform iterations with their precomputed closed form
+#ifndef USE_FAST_TRANSFORM
+#define USE_FAST_TRANSFORM 0
+#endif
+// the entries of the memo of transform results keyed by (opcode, val),
+// 0 to always transform; worth it when the input values repeat
+#ifndef TRANSFORM_CACHE_SIZE
+#define TRANSFORM_CACHE_SIZE 0
+#endif
+// set to 1 to parse the input from a memory mapping instead of an ifstream;
+// several readers always do, as the shards of a ShardedReader
+#ifndef USE_MAPPED_READER
+#define USE_MAPPED_READER 0
+#endif
+// set to 1 to format the output into a large buffer written with write(2)
+#ifndef USE_BUFFERED_WRITER
+#define USE_BUFFERED_WRITER 0
+#endif
+// set to 1 to recycle a fixed number of items instead of allocating one per line
+#ifndef USE_ITEM_POOL
+#define USE_ITEM_POOL 1
+#endif
+// the items in flight, and in ordered mode in the reorder window, may fill
+// every queue, plus the batches of the readers and producers and this many
+// more for the consumers; see PipelineConfig::reorder_window_size
+#ifndef ITEM_POOL_SLACK
+#define ITEM_POOL_SLACK 1024
+#endif
+// set to 1 to write the items in input order instead of completion order
+#ifndef USE_ORDERED_OUTPUT
+#define USE_ORDERED_OUTPUT 0
+#endif
+// set to 1 to collect per-stage throughput, queue occupancy and blocked time,
+// and item latencies, written as JSON to TELEMETRY_FILE at exit
+#ifndef USE_TELEMETRY
+#define USE_TELEMETRY 0
+#endif
+#ifndef TELEMETRY_FILE
+#define TELEMETRY_FILE "./telemetry.json"
+#endif
+// sample the queue sizes every period in microseconds
+#ifndef TELEMETRY_SAMPLE_PERIOD
+#define TELEMETRY_SAMPLE_PERIOD 10000
+#endif
+#ifndef NUM_READERS
+#define NUM_READERS 1
+#endif
+#ifndef NUM_PRODUCERS
+#define NUM_PRODUCERS 4
+#endif
 
 // #define READER_QUEUE_SIZE 200
 // #define WORKER_QUEUE_SIZE 200
@@ -21,37 +133,131 @@
 // #define CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE 80
 // #define CONSUMER_CONTROLLER_CHECK_PERIOD 1000
 
+Queue<Item*>* new_queue(int buffer_size) {
+	if (USE_LOCK_FREE_QUEUE)
+		return new LockFreeQueue<Item*>(buffer_size);
+	return new TSQueue<Item*>(buffer_size, QUEUE_SPIN_LIMIT);
+}
+
+PipelineConfig default_config() {
+	PipelineConfig config;
+	config.readers = NUM_READERS;
+	config.producers = NUM_PRODUCERS;
+	config.reader_queue_size = READER_QUEUE_SIZE;
+	config.worker_queue_size = WORKER_QUEUE_SIZE;
+	config.writer_queue_size = WRITER_QUEUE_SIZE;
+	config.low_threshold = CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE;
+	config.high_threshold = CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE;
+	config.check_period = CONSUMER_CONTROLLER_CHECK_PERIOD;
+	config.policy = CONSUMER_CONTROLLER_POLICY;
+	config.min_consumers = CONSUMER_CONTROLLER_MIN_CONSUMERS;
+	config.max_consumers = CONSUMER_CONTROLLER_MAX_CONSUMERS;
+	config.batch_size = BATCH_SIZE;
+	config.cache_size = TRANSFORM_CACHE_SIZE;
+	config.placement = "none";
+	return config;
+}
+
 int main(int argc, char** argv) {
-	assert(argc == 4);
+	// usage: ./main n input output [placement] [--name=value ...] [--config=file.json]
+	// the optional 4th argument is the thread placement policy: none (the
+	// default), stage or colocate; the rest override the topology, see config.hpp
+	assert(argc >= 4);
 
 	int n = atoi(argv[1]);
 	std::string input_file_name(argv[2]);
 	std::string output_file_name(argv[3]);
 
+	PipelineConfig config = default_config();
+	bool positional = argc > 4 && std::string(argv[4]).compare(0, 2, "--") != 0;
+	if (positional)
+		config.placement = argv[4];
+	if (!config.parse_args(argc, argv, positional ? 5 : 4))
+		return 1;
+
+	int policy = Placement::parse(config.placement);
+	if (policy < 0) {
+		std::cerr << "unknown placement " << config.placement << ", expected none, stage or colocate" << std::endl;
+		return 1;
+	}
+	Placement* placement = new Placement(policy, config.readers, config.producers);
+	long long begin = monotonic_ns();
+
 	// TODO: implements main function
-	TSQueue<Item*>* input_queue = new TSQueue<Item*>(READER_QUEUE_SIZE);
-	TSQueue<Item*>* worker_queue = new TSQueue<Item*>(WORKER_QUEUE_SIZE);
-	TSQueue<Item*>* output_queue = new TSQueue<Item*>(WRITER_QUEUE_SIZE);
+	// every queue lives on the node of the threads that dequeue from it; this
+	// places the buffers allocated up front, not the lanes of a WorkStealingQueue,
+	// whose deques allocate as they grow, on the node of whoever pushes
+	placement->enter_node_of("producer", 0);
+	Queue<Item*>* input_queue = new_queue(config.reader_queue_size);
+	placement->enter_node_of("consumer", 0);
+	Queue<Item*>* worker_queue = USE_WORK_STEALING ?
+		new WorkStealingQueue<Item*>(config.worker_queue_size, WORKER_QUEUE_LANES) : new_queue(config.worker_queue_size);
+	placement->enter_node_of("writer", 0);
+	Queue<Item*>* output_queue = new_queue(config.writer_queue_size);
+	placement->leave_node();
 
 	/* Create */
-	Transformer* transformer = new Transformer;
-	Reader* reader = new Reader(n, input_file_name, input_queue);
-	Producer* producer1 = new Producer(input_queue, worker_queue, transformer);
-	Producer* producer2 = new Producer(input_queue, worker_queue, transformer);
-	Producer* producer3 = new Producer(input_queue, worker_queue, transformer);
-	Producer* producer4 = new Producer(input_queue, worker_queue, transformer);
+	Transformer* transformer = new Transformer(USE_FAST_TRANSFORM);
+	transformer->enable_cache(config.cache_size);
+	ItemPool* item_pool = USE_ITEM_POOL ? new ItemPool(config.item_pool_size(ITEM_POOL_SLACK)) : nullptr;
+	ReorderWindow* reorder_window = USE_ORDERED_OUTPUT ? new ReorderWindow(config.reorder_window_size(ITEM_POOL_SLACK)) : nullptr;
+	Thread* reader;
+	if (config.readers > 1) {
+		ShardedReader* sharded_reader = new ShardedReader(n, input_file_name, input_queue, config.readers, config.batch_size, item_pool, reorder_window);
+		sharded_reader->set_placement(placement);
+		reader = sharded_reader;
+	} else if (USE_MAPPED_READER) {
+		reader = new MappedReader(n, input_file_name, input_queue, config.batch_size, item_pool, reorder_window);
+	} else {
+		reader = new Reader(n, input_file_name, input_queue, config.batch_size, item_pool, reorder_window);
+	}
+	std::vector<Producer*> producers;
+	for (int i = 0; i < config.producers; i++) {
+		producers.push_back(new Producer(input_queue, worker_queue, transformer, config.batch_size));
+	}
 	ConsumerController* consumer_controller = new ConsumerController(worker_queue, output_queue, transformer, 
-												CONSUMER_CONTROLLER_CHECK_PERIOD, 
-												CONSUMER_CONTROLLER_LOW_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100, 
-												CONSUMER_CONTROLLER_HIGH_THRESHOLD_PERCENTAGE * WORKER_QUEUE_SIZE / 100);
-	Writer* writer = new Writer(n, output_file_name, output_queue);
+												config.check_period, 
+												config.low_threshold * config.worker_queue_size / 100, 
+												config.high_threshold * config.worker_queue_size / 100,
+												config.batch_size,
+												config.policy,
+												config.max_consumers,
+												config.min_consumers);
+	Thread* writer;
+	if (USE_BUFFERED_WRITER)
+		writer = new BufferedWriter(n, output_file_name, output_queue, config.batch_size, item_pool, reorder_window);
+	else
+		writer = new Writer(n, output_file_name, output_queue, config.batch_size, item_pool, reorder_window);
+
+	reader->set_cpu(placement->cpu_for("reader", 0));
+	for (int i = 0; i < config.producers; i++) {
+		producers[i]->set_cpu(placement->cpu_for("producer", i));
+	}
+	consumer_controller->set_placement(placement);
+	writer->set_cpu(placement->cpu_for("writer", 0));
+
+	Telemetry* telemetry = nullptr;
+	if (USE_TELEMETRY) {
+		telemetry = new Telemetry(TELEMETRY_SAMPLE_PERIOD);
+		telemetry->register_queue("input", input_queue);
+		telemetry->register_queue("worker", worker_queue);
+		telemetry->register_queue("output", output_queue);
+
+		reader->set_telemetry(telemetry);
+		for (Producer* producer : producers) {
+			producer->set_telemetry(telemetry);
+		}
+		consumer_controller->set_telemetry(telemetry);
+		writer->set_telemetry(telemetry);
+	}
 
 	/* start */
+	if (telemetry)
+		telemetry->start();
 	reader->start();
-	producer1->start();
-	producer2->start();
-	producer3->start();
-	producer4->start();
+	for (Producer* producer : producers) {
+		producer->start();
+	}
 	consumer_controller->start();
 	writer->start();
 
@@ -59,18 +265,52 @@ int main(int argc, char** argv) {
 	reader->join();
 	writer->join();
 
+	if (policy != PLACEMENT_NONE) {
+		// from argv[4], --placement or a config file alike; scripts/bench.py
+		// --placements=none,stage,colocate reports the speedup over none
+		std::cerr << "placement " << config.placement << ": " << (monotonic_ns() - begin) / 1e9 << " s" << std::endl;
+	}
+
+	/* drain and join */
+	// every item is written, so the queues are empty; a poison pill per
+	// producer stops them, and the controller retires its consumers the same way
+	for (int i = 0; i < config.producers; i++) {
+		input_queue->enqueue(nullptr);
+	}
+	for (Producer* producer : producers) {
+		producer->join();
+	}
+	consumer_controller->stop();
+	consumer_controller->join();
+
+	if (config.cache_size > 0) {
+		long long hits = transformer->get_cache_hits();
+		long long lookups = hits + transformer->get_cache_misses();
+		std::cerr << "transform cache: " << hits << " hits in " << lookups << " lookups ("
+			<< (lookups > 0 ? 100.0 * hits / lookups : 0) << "%)" << std::endl;
+	}
+
+	if (telemetry) {
+		telemetry->stop();
+		telemetry->join();
+		telemetry->dump(TELEMETRY_FILE);
+	}
+
 	/* delete */
 	delete input_queue;
 	delete worker_queue;
 	delete output_queue;
 	delete transformer;
 	delete reader;
-	delete producer1;
-	delete producer2;
-	delete producer3;
-	delete producer4;
+	for (Producer* producer : producers) {
+		delete producer;
+	}
 	delete consumer_controller;
 	delete writer;
+	delete item_pool;
+	delete reorder_window;
+	delete telemetry;
+	delete placement;
 	
 	return 0;
 }
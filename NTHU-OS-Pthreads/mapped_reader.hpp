@@ -0,0 +1,230 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "thread.hpp"
+#include "queue.hpp"
+#include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_window.hpp"
+#include "telemetry.hpp"
+
+#ifndef MAPPED_READER_HPP
+#define MAPPED_READER_HPP
+
+// A Reader that maps the input file into memory and parses the
+// "key val opcode" lines in place, without going through iostreams.
+// Several of them can split one file, see ShardedReader: each parses its own
+// byte range, knowing the line number it starts at, and together they read
+// the first expected lines of the file.
+class MappedReader : public Thread {
+public:
+	// constructor
+	MappedReader(int expected_lines, std::string input_file, Queue<Item*>* input_queue, int batch_size = 1, ItemPool* pool = nullptr, ReorderWindow* window = nullptr);
+
+	// destructor
+	~MappedReader();
+
+	virtual void start() override;
+
+	// parse only the index-th of count byte ranges of the file, each starting
+	// and ending on a line boundary; call before start()
+	void set_shard(int index, int count);
+
+	// return the number of lines left to parse, one item per line; blank
+	// lines are skipped as the parser does
+	long long count_lines();
+
+	// number the lines from first_seq, the number of lines before this
+	// reader's range; only the lines numbered below expected_lines are read
+	void set_first_seq(long long first_seq);
+private:
+	// the line number of the next line, and the one to stop reading at
+	long long next_seq;
+	long long last_seq;
+
+	// the mapped input file, [data, end) is what is left to parse
+	const char* base;
+	const char* data;
+	const char* end;
+	size_t length;
+
+	Queue<Item*>* input_queue;
+
+	// the number of items handed to the input queue at once
+	int batch_size;
+	Item** batch;
+
+	// where the items come from, they are allocated with new if null
+	ItemPool* pool;
+
+	// stamps the items with their sequence numbers in ordered output mode, may be null
+	ReorderWindow* window;
+
+	// skip whitespaces and parse the next unsigned integer
+	unsigned long long parse_number();
+
+	// skip whitespaces and return whether a line is left to parse
+	bool has_line();
+
+	// return the first line starting at or after offset
+	const char* line_at(size_t offset);
+
+	// return how many of the next n lines are numbered below last_seq
+	int take(int n);
+
+	// skip whitespaces and return the next character
+	char parse_char();
+
+	// the method for pthread to create a reader thread
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+MappedReader::MappedReader(int expected_lines, std::string input_file, Queue<Item*>* input_queue, int batch_size, ItemPool* pool, ReorderWindow* window)
+	: input_queue(input_queue), batch_size(batch_size), pool(pool), window(window) {
+	next_seq = 0;
+	last_seq = expected_lines;
+	base = data = end = nullptr;
+	length = 0;
+
+	int fd = open(input_file.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+		length = st.st_size;
+		void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr != MAP_FAILED) {
+			madvise(addr, length, MADV_SEQUENTIAL);
+			base = data = (const char*)addr;
+			end = data + length;
+		} else {
+			length = 0;
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+
+	batch = new Item* [batch_size];
+}
+
+MappedReader::~MappedReader() {
+	if (length > 0)
+		munmap((void*)base, length);
+	delete [] batch;
+}
+
+void MappedReader::start() {
+	create(MappedReader::process, (void*)this);
+}
+
+void MappedReader::set_shard(int index, int count) {
+	data = line_at(length * index / count);
+	end = line_at(length * (index + 1) / count);
+}
+
+const char* MappedReader::line_at(size_t offset) {
+	// neighbouring shards agree on their boundary, since both look for the
+	// same newline
+	const char* line = base + offset;
+	while (line > base && line < base + length && line[-1] != '\n')
+		line++;
+	return line;
+}
+
+bool MappedReader::has_line() {
+	while (data < end && (*data == ' ' || *data == '\n' || *data == '\r' || *data == '\t'))
+		data++;
+	return data < end;
+}
+
+long long MappedReader::count_lines() {
+	long long lines = 0;
+	const char* line = data;
+	while (line < end) {
+		const char* newline = (const char*)memchr(line, '\n', end - line);
+		if (newline == nullptr)
+			newline = end;
+		while (line < newline && (*line == ' ' || *line == '\r' || *line == '\t'))
+			line++;
+		if (line < newline)
+			lines++;
+		line = newline + 1;
+	}
+	return lines;
+}
+
+void MappedReader::set_first_seq(long long first_seq) {
+	next_seq = first_seq;
+}
+
+int MappedReader::take(int n) {
+	// the line numbers decide, no other reader takes these lines
+	long long left = last_seq - next_seq;
+	return left < n ? (left > 0 ? left : 0) : n;
+}
+
+unsigned long long MappedReader::parse_number() {
+	while (data < end && (*data == ' ' || *data == '\n' || *data == '\r' || *data == '\t'))
+		data++;
+
+	unsigned long long val = 0;
+	while (data < end && *data >= '0' && *data <= '9') {
+		val = val * 10 + (*data - '0');
+		data++;
+	}
+	return val;
+}
+
+char MappedReader::parse_char() {
+	while (data < end && (*data == ' ' || *data == '\n' || *data == '\r' || *data == '\t'))
+		data++;
+
+	return data < end ? *data++ : '\0';
+}
+
+void* MappedReader::process(void* arg) {
+	MappedReader* reader = (MappedReader*)arg;
+	StageCounters* counters = reader->telemetry ? reader->telemetry->register_thread("reader") : nullptr;
+
+	while (reader->next_seq < reader->last_seq) {
+		long long now = counters ? monotonic_ns() : 0;
+
+		int count = 0;
+		while (count < reader->batch_size && reader->has_line()) {
+			Item *item = reader->pool ? reader->pool->get() : new Item;
+			item->key = reader->parse_number();
+			item->val = reader->parse_number();
+			item->opcode = reader->parse_char();
+			item->born_ns = now;
+			reader->batch[count++] = item;
+		}
+
+		// the lines parsed past the last one to read are dropped
+		int taken = reader->take(count);
+		for (int i = taken; i < count; i++) {
+			if (reader->pool)
+				reader->pool->put(reader->batch[i]);
+			else
+				delete reader->batch[i];
+		}
+		if (taken == 0)
+			break;
+
+		if (reader->window) {
+			for (int i = 0; i < taken; i++) {
+				reader->window->stamp(reader->batch[i], reader->next_seq + i);
+			}
+		}
+		reader->next_seq += taken;
+		reader->input_queue->enqueue_bulk(reader->batch, taken);
+		if (counters)
+			counters->add(taken, monotonic_ns());
+	}
+
+	return nullptr;
+}
+
+#endif // MAPPED_READER_HPP
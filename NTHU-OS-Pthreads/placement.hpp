@@ -0,0 +1,138 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+// leave the threads to the scheduler
+#define PLACEMENT_NONE 0
+// give every stage its own cores: the readers, the writer, then the producers,
+// then the consumers, wrapping around when there are not enough cores
+#define PLACEMENT_STAGE 1
+// like PLACEMENT_STAGE, but consumer k shares the core of producer
+// k % num_producers, so the items it drains are still in that core's cache
+#define PLACEMENT_COLOCATE 2
+
+// the most NUMA nodes looked for in sysfs
+#define PLACEMENT_MAX_NODES 64
+
+// Decides the cpu every pipeline thread runs on and the NUMA node its queue
+// memory is allocated on.
+// Only the cpus the process may run on are used. Queue memory is placed by
+// first touch: the queue is constructed while the calling thread is bound to
+// the node of the threads that will use it. That only covers memory the queue
+// allocates and touches in its constructor, as TSQueue and LockFreeQueue do;
+// the deques of a WorkStealingQueue allocate as they grow, on the pusher's node.
+class Placement {
+public:
+	// constructor
+	Placement(int policy, int num_readers, int num_producers);
+
+	// return the policy called name, -1 if there is none
+	static int parse(std::string name);
+
+	// return the cpu the index-th thread of stage should run on, -1 for any;
+	// stage is one of "reader", "writer", "producer" or "consumer"
+	int cpu_for(std::string stage, int index);
+
+	// bind the calling thread to the NUMA node of the index-th thread of stage,
+	// so the memory it touches from now on comes from that node
+	void enter_node_of(std::string stage, int index);
+
+	// let the calling thread run anywhere again
+	void leave_node();
+
+	int get_policy();
+private:
+	int policy;
+	int num_readers;
+	int num_producers;
+
+	// the cpus the process may run on
+	std::vector<int> cpus;
+	cpu_set_t allowed;
+
+	// return the NUMA node of cpu, 0 if unknown
+	static int node_of(int cpu);
+};
+
+// Implementation start
+
+Placement::Placement(int policy, int num_readers, int num_producers)
+	: policy(policy), num_readers(num_readers), num_producers(num_producers) {
+	CPU_ZERO(&allowed);
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	for (int i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &allowed))
+			cpus.push_back(i);
+	}
+}
+
+int Placement::parse(std::string name) {
+	if (name == "none")
+		return PLACEMENT_NONE;
+	if (name == "stage")
+		return PLACEMENT_STAGE;
+	if (name == "colocate")
+		return PLACEMENT_COLOCATE;
+	return -1;
+}
+
+int Placement::cpu_for(std::string stage, int index) {
+	if (policy == PLACEMENT_NONE || cpus.empty())
+		return -1;
+
+	int slot;
+	if (stage == "reader")
+		slot = index;
+	else if (stage == "writer")
+		slot = num_readers;
+	else if (stage == "producer")
+		slot = num_readers + 1 + index;
+	else if (policy == PLACEMENT_COLOCATE)
+		slot = num_readers + 1 + index % num_producers;
+	else
+		slot = num_readers + 1 + num_producers + index;
+
+	return cpus[slot % cpus.size()];
+}
+
+void Placement::enter_node_of(std::string stage, int index) {
+	int cpu = cpu_for(stage, index);
+	if (cpu < 0)
+		return;
+
+	int node = node_of(cpu);
+	cpu_set_t local;
+	CPU_ZERO(&local);
+	for (size_t i = 0; i < cpus.size(); i++) {
+		if (node_of(cpus[i]) == node)
+			CPU_SET(cpus[i], &local);
+	}
+	sched_setaffinity(0, sizeof(local), &local);
+}
+
+void Placement::leave_node() {
+	if (policy != PLACEMENT_NONE)
+		sched_setaffinity(0, sizeof(allowed), &allowed);
+}
+
+int Placement::get_policy() {
+	return policy;
+}
+
+int Placement::node_of(int cpu) {
+	char path[64];
+	for (int node = 0; node < PLACEMENT_MAX_NODES; node++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+		if (access(path, F_OK) == 0)
+			return node;
+	}
+	return 0;
+}
+
+#endif // PLACEMENT_HPP
@@ -1,8 +1,9 @@
 #include <pthread.h>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
 #include "transformer.hpp"
+#include "telemetry.hpp"
 
 #ifndef PRODUCER_HPP
 #define PRODUCER_HPP
@@ -10,41 +11,84 @@
 class Producer : public Thread {
 public:
 	// constructor
-	Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transfomrer);
+	Producer(Queue<Item*>* input_queue, Queue<Item*>* worker_queue, Transformer* transfomrer, int batch_size = 1);
 
 	// destructor
 	~Producer();
 
 	virtual void start();
 private:
-	TSQueue<Item*>* input_queue;
-	TSQueue<Item*>* worker_queue;
+	Queue<Item*>* input_queue;
+	Queue<Item*>* worker_queue;
 
 	Transformer* transformer;
 
+	// the maximum number of items taken from the input queue at once
+	int batch_size;
+	Item** batch;
+	// the opcodes and values of the batch, transformed together
+	char* opcodes;
+	unsigned long long* vals;
+
 	// the method for pthread to create a producer thread
 	static void* process(void* arg);
 };
 
-Producer::Producer(TSQueue<Item*>* input_queue, TSQueue<Item*>* worker_queue, Transformer* transformer)
-	: input_queue(input_queue), worker_queue(worker_queue), transformer(transformer) {
+Producer::Producer(Queue<Item*>* input_queue, Queue<Item*>* worker_queue, Transformer* transformer, int batch_size)
+	: input_queue(input_queue), worker_queue(worker_queue), transformer(transformer), batch_size(batch_size) {
+	batch = new Item* [batch_size];
+	opcodes = new char [batch_size];
+	vals = new unsigned long long [batch_size];
 }
 
-Producer::~Producer() {}
+Producer::~Producer() {
+	delete [] batch;
+	delete [] opcodes;
+	delete [] vals;
+}
 
 void Producer::start() {
 	// TODO: starts a Producer thread
-	pthread_create(&t, 0, Producer::process, (void*)this);
+	create(Producer::process, (void*)this);
 }
 
 void* Producer::process(void* arg) {
 	// TODO: implements the Producer's work
 	Producer* producer = (Producer*)arg;
+	StageCounters* counters = producer->telemetry ? producer->telemetry->register_thread("producer") : nullptr;
 
 	while (true) {
-		Item* item = producer->input_queue->dequeue();
-		item->val = producer->transformer->producer_transform(item->opcode, item->val);
-		producer->worker_queue->enqueue(item);
+		int count = producer->input_queue->dequeue_bulk(producer->batch, producer->batch_size);
+
+		// a null item is a poison pill asking one producer to stop
+		int live = 0, pills = 0;
+		for (int i = 0; i < count; i++) {
+			Item* item = producer->batch[i];
+			if (item == nullptr) {
+				pills++;
+				continue;
+			}
+			producer->opcodes[live] = item->opcode;
+			producer->vals[live] = item->val;
+			producer->batch[live++] = item;
+		}
+
+		// the items sharing an opcode are transformed side by side
+		producer->transformer->producer_transform_batch(producer->opcodes, producer->vals, live);
+		for (int i = 0; i < live; i++) {
+			producer->batch[i]->val = producer->vals[i];
+		}
+		if (live > 0)
+			producer->worker_queue->enqueue_bulk(producer->batch, live);
+		if (counters && live > 0)
+			counters->add(live, monotonic_ns());
+
+		if (pills > 0) {
+			for (int i = 1; i < pills; i++) {
+				producer->input_queue->enqueue(nullptr);
+			}
+			break;
+		}
 	}
 
 	return nullptr;
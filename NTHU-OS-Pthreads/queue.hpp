@@ -0,0 +1,191 @@
+#include <atomic>
+#include "clock.hpp"
+
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// notified by a queue whenever its size crosses one of its watermarks
+class QueueListener {
+public:
+	virtual ~QueueListener() {}
+
+	// called with the new size, possibly while the queue holds its own lock,
+	// so it must not call back into the queue
+	virtual void watermark_crossed(int size) = 0;
+};
+
+// the common interface of the blocking queues connecting the pipeline stages
+template <class T>
+class Queue {
+public:
+	Queue();
+
+	virtual ~Queue() {}
+
+	// add an element to the end of the queue, block while the queue is full
+	virtual void enqueue(T item) = 0;
+
+	// remove and return the first element of the queue, block while the queue is empty
+	virtual T dequeue() = 0;
+
+	// add n elements to the end of the queue, block until all of them are in
+	virtual void enqueue_bulk(T* items, int n) = 0;
+
+	// remove up to max elements into out, block until at least one is available,
+	// return the number of elements removed
+	virtual int dequeue_bulk(T* out, int max) = 0;
+
+	// return the number of elements in the queue
+	virtual int get_size() = 0;
+
+	// return the queue the i-th worker draining this queue should dequeue from,
+	// queues without per-worker lanes hand out themselves
+	virtual Queue<T>* lane(int i) { return this; }
+
+	// notify listener when the size rises above high or falls below low
+	void set_watermarks(int low, int high, QueueListener* listener);
+
+	// start counting the elements added to and removed from the queue; a queue
+	// with watermarks counts them too, and one with neither skips the counters
+	void enable_counting();
+
+	// return the number of elements added to the queue since counting started
+	long long get_enqueued();
+
+	// return the number of elements removed from the queue since counting started
+	long long get_dequeued();
+
+	// start measuring how long callers are blocked in the queue
+	void enable_wait_timing();
+
+	// return the total time enqueuers were blocked on a full queue in nanoseconds
+	long long get_enqueue_wait_ns();
+
+	// return the total time dequeuers were blocked on an empty queue in nanoseconds
+	long long get_dequeue_wait_ns();
+protected:
+	// return whether size_changed needs to be told, implementations whose
+	// size is costly to read only compute it when it does
+	bool size_watched();
+
+	// called by the implementations whenever the size went from old_size to new_size
+	void size_changed(int old_size, int new_size);
+
+	// called by the implementations right before a caller starts to block,
+	// the result is handed to enqueue_wait_end or dequeue_wait_end once it is done
+	long long wait_begin();
+	void enqueue_wait_end(long long begin);
+	void dequeue_wait_end(long long begin);
+private:
+	int low_watermark;
+	int high_watermark;
+	QueueListener* listener;
+	bool counting;
+
+	// enqueuers and dequeuers usually run on different cores, so each
+	// counter is kept on its own cache line
+	char pad0[CACHE_LINE_SIZE];
+	std::atomic<long long> enqueued;
+	char pad1[CACHE_LINE_SIZE - sizeof(std::atomic<long long>)];
+	std::atomic<long long> dequeued;
+	char pad2[CACHE_LINE_SIZE - sizeof(std::atomic<long long>)];
+
+	bool wait_timing;
+	std::atomic<long long> enqueue_wait_ns;
+	std::atomic<long long> dequeue_wait_ns;
+};
+
+// Implementation start
+
+template <class T>
+Queue<T>::Queue() : low_watermark(0), high_watermark(0), listener(nullptr), counting(false), wait_timing(false) {
+	enqueued.store(0);
+	dequeued.store(0);
+	enqueue_wait_ns.store(0);
+	dequeue_wait_ns.store(0);
+}
+
+template <class T>
+void Queue<T>::set_watermarks(int low, int high, QueueListener* listener) {
+	low_watermark = low;
+	high_watermark = high;
+	this->listener = listener;
+}
+
+template <class T>
+void Queue<T>::enable_counting() {
+	counting = true;
+}
+
+template <class T>
+long long Queue<T>::get_enqueued() {
+	return enqueued.load(std::memory_order_relaxed);
+}
+
+template <class T>
+long long Queue<T>::get_dequeued() {
+	return dequeued.load(std::memory_order_relaxed);
+}
+
+template <class T>
+void Queue<T>::enable_wait_timing() {
+	wait_timing = true;
+}
+
+template <class T>
+long long Queue<T>::get_enqueue_wait_ns() {
+	return enqueue_wait_ns.load(std::memory_order_relaxed);
+}
+
+template <class T>
+long long Queue<T>::get_dequeue_wait_ns() {
+	return dequeue_wait_ns.load(std::memory_order_relaxed);
+}
+
+template <class T>
+long long Queue<T>::wait_begin() {
+	// never 0, so that callers can use 0 for "not waiting yet"
+	return wait_timing ? monotonic_ns() : -1;
+}
+
+template <class T>
+void Queue<T>::enqueue_wait_end(long long begin) {
+	if (begin > 0)
+		enqueue_wait_ns.fetch_add(monotonic_ns() - begin, std::memory_order_relaxed);
+}
+
+template <class T>
+void Queue<T>::dequeue_wait_end(long long begin) {
+	if (begin > 0)
+		dequeue_wait_ns.fetch_add(monotonic_ns() - begin, std::memory_order_relaxed);
+}
+
+template <class T>
+bool Queue<T>::size_watched() {
+	return counting || listener != nullptr;
+}
+
+template <class T>
+void Queue<T>::size_changed(int old_size, int new_size) {
+	if (!size_watched())
+		return;
+
+	if (new_size > old_size)
+		enqueued.fetch_add(new_size - old_size, std::memory_order_relaxed);
+	else
+		dequeued.fetch_add(old_size - new_size, std::memory_order_relaxed);
+
+	if (listener == nullptr)
+		return;
+
+	if ((old_size <= high_watermark && new_size > high_watermark) ||
+		(old_size >= low_watermark && new_size < low_watermark)) {
+		listener->watermark_crossed(new_size);
+	}
+}
+
+#endif // QUEUE_HPP
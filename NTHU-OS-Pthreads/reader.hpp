@@ -1,7 +1,10 @@
 #include <fstream>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_window.hpp"
+#include "telemetry.hpp"
 
 #ifndef READER_HPP
 #define READER_HPP
@@ -9,7 +12,7 @@
 class Reader : public Thread {
 public:
 	// constructor
-	Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue);
+	Reader(int expected_lines, std::string input_file, Queue<Item*>* input_queue, int batch_size = 1, ItemPool* pool = nullptr, ReorderWindow* window = nullptr);
 
 	// destructor
 	~Reader();
@@ -21,7 +24,17 @@ private:
 	int expected_lines;
 
 	std::ifstream ifs;
-	TSQueue<Item*>* input_queue;
+	Queue<Item*>* input_queue;
+
+	// the number of items handed to the input queue at once
+	int batch_size;
+	Item** batch;
+
+	// where the items come from, they are allocated with new if null
+	ItemPool* pool;
+
+	// stamps the items with their sequence numbers in ordered output mode, may be null
+	ReorderWindow* window;
 
 	// the method for pthread to create a reader thread
 	static void* process(void* arg);
@@ -29,26 +42,41 @@ private:
 
 // Implementaion start
 
-Reader::Reader(int expected_lines, std::string input_file, TSQueue<Item*>* input_queue)
-	: expected_lines(expected_lines), input_queue(input_queue) {
+Reader::Reader(int expected_lines, std::string input_file, Queue<Item*>* input_queue, int batch_size, ItemPool* pool, ReorderWindow* window)
+	: expected_lines(expected_lines), input_queue(input_queue), batch_size(batch_size), pool(pool), window(window) {
 	ifs = std::ifstream(input_file);
+	batch = new Item* [batch_size];
 }
 
 Reader::~Reader() {
 	ifs.close();
+	delete [] batch;
 }
 
 void Reader::start() {
-	pthread_create(&t, 0, Reader::process, (void*)this);
+	create(Reader::process, (void*)this);
 }
 
 void* Reader::process(void* arg) {
 	Reader* reader = (Reader*)arg;
+	StageCounters* counters = reader->telemetry ? reader->telemetry->register_thread("reader") : nullptr;
+
+	while (reader->expected_lines > 0) {
+		int count = reader->expected_lines < reader->batch_size ? reader->expected_lines : reader->batch_size;
+		long long now = counters ? monotonic_ns() : 0;
 
-	while (reader->expected_lines--) {
-		Item *item = new Item;
-		reader->ifs >> *item;
-		reader->input_queue->enqueue(item);
+		for (int i = 0; i < count; i++) {
+			Item *item = reader->pool ? reader->pool->get() : new Item;
+			reader->ifs >> *item;
+			if (reader->window)
+				reader->window->stamp(item);
+			item->born_ns = now;
+			reader->batch[i] = item;
+		}
+		reader->input_queue->enqueue_bulk(reader->batch, count);
+		if (counters)
+			counters->add(count, monotonic_ns());
+		reader->expected_lines -= count;
 	}
 
 	return nullptr;
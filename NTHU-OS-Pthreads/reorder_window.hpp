@@ -0,0 +1,118 @@
+#include <pthread.h>
+#include "item.hpp"
+
+#ifndef REORDER_WINDOW_HPP
+#define REORDER_WINDOW_HPP
+
+// Puts items back into the order the reader saw them.
+// The reader stamps every item with the next sequence number through
+// stamp(), which blocks while the item would land more than size positions
+// ahead of the next one to be written. The writer insert()s items as they
+// arrive and pop()s the contiguous run starting at the next sequence number.
+// At most size items are ever held, and a full window holds back the reader.
+// Several readers that know the line numbers of their items stamp them with
+// stamp(item, seq) instead, and each blocks until its items fit the window.
+class ReorderWindow {
+public:
+	// constructor
+	explicit ReorderWindow(int size);
+
+	// destructor
+	~ReorderWindow();
+
+	// give item the next sequence number, block while the window is full
+	void stamp(Item* item);
+
+	// give item the sequence number seq, block while it is size or more
+	// positions ahead of the next one to be written
+	void stamp(Item* item, long long seq);
+
+	// hold an item until every item before it has been popped
+	void insert(Item* item);
+
+	// return the next item in sequence, or nullptr if it has not arrived yet
+	Item* pop();
+
+	// let the reader know about the items popped since the last commit
+	void commit();
+private:
+	int size;
+	// the held items, item with sequence number seq lives in slots[seq % size]
+	Item** slots;
+
+	// the sequence number of the next item to pop, owned by the writer
+	long long next;
+
+	// the next sequence number to stamp and the number of items committed
+	// by the writer, guarded by mutex
+	long long stamped;
+	long long committed;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_stamp;
+};
+
+// Implementation start
+
+ReorderWindow::ReorderWindow(int size) : size(size) {
+	slots = new Item* [size];
+	for (int i = 0; i < size; i++) {
+		slots[i] = nullptr;
+	}
+
+	next = 0;
+	stamped = 0;
+	committed = 0;
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond_stamp, NULL);
+}
+
+ReorderWindow::~ReorderWindow() {
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_stamp);
+	delete [] slots;
+}
+
+void ReorderWindow::stamp(Item* item) {
+	pthread_mutex_lock(&mutex);
+	while (stamped - committed >= size) {
+		pthread_cond_wait(&cond_stamp, &mutex);
+	}
+	item->seq = stamped++;
+	pthread_mutex_unlock(&mutex);
+}
+
+void ReorderWindow::stamp(Item* item, long long seq) {
+	pthread_mutex_lock(&mutex);
+	while (seq - committed >= size) {
+		pthread_cond_wait(&cond_stamp, &mutex);
+	}
+	item->seq = seq;
+	pthread_mutex_unlock(&mutex);
+}
+
+void ReorderWindow::insert(Item* item) {
+	slots[item->seq % size] = item;
+}
+
+Item* ReorderWindow::pop() {
+	Item* item = slots[next % size];
+	if (item == nullptr)
+		return nullptr;
+
+	slots[next % size] = nullptr;
+	next++;
+	return item;
+}
+
+void ReorderWindow::commit() {
+	pthread_mutex_lock(&mutex);
+	if (committed != next) {
+		committed = next;
+		pthread_cond_broadcast(&cond_stamp);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+#endif // REORDER_WINDOW_HPP
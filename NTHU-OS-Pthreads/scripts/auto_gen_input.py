@@ -4,6 +4,22 @@ import click
 import json
 import random
 
+def generate_items(n, spec):
+	# yields (key, val, opcode); spec['choices'] maps an exclusive upper bound
+	# on the item index to the opcodes to pick from below it
+	for i in range(n):
+		key = i + 1
+		val = random.randint(spec['low'], spec['high'])
+
+		opcode = ''
+
+		for c in spec['choices']:
+			if i < int(c):
+				opcode = random.choice(spec['choices'][c])
+				break
+
+		yield key, val, opcode
+
 @click.command()
 @click.option('--input', default='./tests/00_spec.json', help='Input json file path.')
 @click.option('--output', default='./tests/00.out', help='Output file path.')
@@ -21,17 +37,7 @@ def generate(input, output):
 		print('\033[1;34;48m' + json.dumps(spec, indent=2) + '\033[1;37;0m')
 
 	with open(output, 'w') as f:
-		for i in range(n):
-			key = i + 1
-			val = random.randint(spec['low'], spec['high'])
-
-			opcode = ''
-
-			for c in spec['choices']:
-				if i < int(c):
-					opcode = random.choice(spec['choices'][c])
-					break
-
+		for key, val, opcode in generate_items(n, spec):
 			print(key, val, opcode, file=f)
 
 	print('\n\033[1;32;48m' + f'done: [{output}].' + '\033[1;37;0m')
@@ -3,61 +3,292 @@
 import click
 import json
 
-def generate_case(opcode, annotation, case_spec):
+ULL_MAX = (1 << 64) - 1
+
+def compose(f, g, m):
+	# the affine map x -> g(f(x)) modulo m, each map given as (a, b) for x -> a * x + b
+	return (f[0] * g[0] % m, (f[1] * g[0] + g[1]) % m)
+
+def power(f, n, m):
+	# the affine map f applied n times, by repeated squaring
+	result = (1, 0)
+	while n > 0:
+		if n & 1:
+			result = compose(result, f, m)
+		f = compose(f, f, m)
+		n >>= 1
+	return result
+
+def composed_map(case_spec):
+	a, b, m, iterations = case_spec['a'], case_spec['b'], case_spec['m'], case_spec['iterations']
+
+	# after the first iteration val < m, so the remaining ones are an exact affine
+	# map modulo m as long as val * a + b cannot overflow an unsigned long long
+	if iterations < 1 or (m - 1) * a + b > ULL_MAX:
+		return None
+
+	return power((a % m, b % m), iterations - 1, m)
+
+def barrett_constants(case_spec):
+	a, b, m = case_spec['a'], case_spec['b'], case_spec['m']
+	bits = m.bit_length()
+
+	# the batch kernels multiply 32-bit halves: val < m, a, the shifted
+	# x = val * a + b < 4^bits, mu and the quotient must all fit in 32 bits
+	if m < 2 or bits > 31 or a < 0 or b < 0 or a >= 1 << bits or b >= 1 << bits:
+		return None
+
+	mu = (1 << (2 * bits)) // m
+	if mu >= 1 << 32:
+		return None
+
+	return (mu, bits)
+
+def generate_entry(opcode, annotation, case_spec):
+	composed = composed_map(case_spec)
+	if composed is None:
+		composed = (0, 0)
+		has_composed = 'false'
+	else:
+		has_composed = 'true'
+
+	barrett = barrett_constants(case_spec)
+	if barrett is None:
+		barrett = (0, 0)
+		has_barrett = 'false'
+	else:
+		has_barrett = 'true'
+
 	template = f'''
-	// {annotation}
-	case '{opcode}':
-		spec->a = {case_spec['a']};
-		spec->b = {case_spec['b']};
-		spec->m = {case_spec['m']};
-		spec->iterations = {case_spec['iterations']};
-		break;
+	// '{opcode}': {annotation}
+	{{{case_spec['a']}ULL, {case_spec['b']}ULL, {case_spec['m']}ULL, {case_spec['iterations']}, {composed[0]}ULL, {composed[1]}ULL, {has_composed}, {barrett[0]}ULL, {barrett[1]}, {has_barrett}}},'''
+
+	return template
+
+def generate_table(name, opcodes, spec, stage):
+	base = min(ord(opcode) for opcode in opcodes)
+
+	entries = ''
+	for i in range(max(ord(opcode) for opcode in opcodes) - base + 1):
+		opcode = chr(base + i)
+		if opcode in opcodes:
+			entries += generate_entry(opcode, spec['annotation'][opcode], spec[stage][opcode])
+		else:
+			entries += f'''
+	// '{opcode}': not in the spec
+	{{0ULL, 0ULL, 0ULL, 0, 0ULL, 0ULL, false, 0ULL, 0, false}},'''
+
+	return f'''static constexpr TransformSpec {name}[OPCODE_COUNT] = {{{entries}
+}};
 '''
-	
+
+def generate_case(opcode, case_spec):
+	template = f'''
+	case '{opcode}':
+		return iterate<{case_spec['a']}ULL, {case_spec['b']}ULL, {case_spec['m']}ULL>(val, spec->iterations);'''
+
 	return template
 
 def generate_cpp(spec):
-	producer_spec = ''
-	for opcode in spec['annotation']:
-		producer_spec += generate_case(opcode, spec['annotation'][opcode], spec['producer'][opcode])
+	opcodes = list(spec['annotation'])
+	base = min(opcodes)
+	count = ord(max(opcodes)) - ord(base) + 1
+
+	producer_table = generate_table('producer_specs', opcodes, spec, 'producer')
+	consumer_table = generate_table('consumer_specs', opcodes, spec, 'consumer')
 
-	consumer_spec = ''
-	for opcode in spec['annotation']:
-		consumer_spec += generate_case(opcode, spec['annotation'][opcode], spec['consumer'][opcode])
+	producer_cases = ''
+	consumer_cases = ''
+	for opcode in opcodes:
+		producer_cases += generate_case(opcode, spec['producer'][opcode])
+		consumer_cases += generate_case(opcode, spec['consumer'][opcode])
 
 	template = f'''// CODEGEN BY auto_gen_transformer.py; DO NOT EDIT.
 
 #include <assert.h>
 #include "transformer.hpp"
+#include "transform_kernel.hpp"
+#include "transform_cache.hpp"
 
-unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {{
-	TransformSpec* spec = new TransformSpec;
+// the spec tables are indexed by opcode - OPCODE_BASE,
+// an entry with m == 0 stands for an opcode missing from the spec
+static constexpr char OPCODE_BASE = '{base}';
+static constexpr int OPCODE_COUNT = {count};
 
-	switch (opcode) {{{producer_spec}
-	default:
-		assert(false);
+{producer_table}
+{consumer_table}
+static const TransformSpec* lookup(const TransformSpec* specs, char opcode) {{
+	assert(opcode >= OPCODE_BASE && opcode < OPCODE_BASE + OPCODE_COUNT);
+	const TransformSpec* spec = &specs[opcode - OPCODE_BASE];
+	assert(spec->m != 0);
+	return spec;
+}}
+
+// the transform loop with a, b and m fixed at compile time,
+// so that the compiler can strength-reduce the modulo for every opcode
+template <unsigned long long a, unsigned long long b, unsigned long long m>
+static unsigned long long iterate(unsigned long long val, int iterations) {{
+	while (iterations--) {{
+		val = (val * a + b) % m;
 	}}
+	return val;
+}}
+
+Transformer::~Transformer() {{
+	delete cache;
+}}
+
+void Transformer::enable_cache(int capacity) {{
+	delete cache;
+	cache = capacity > 0 ? new TransformCache(capacity) : nullptr;
+}}
+
+long long Transformer::get_cache_hits() {{
+	return cache ? cache->get_hits() : 0;
+}}
 
-	return transform(spec, val);
+long long Transformer::get_cache_misses() {{
+	return cache ? cache->get_misses() : 0;
+}}
+
+unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {{
+	unsigned long long result;
+	if (cache && cache->lookup(TRANSFORM_CACHE_PRODUCER, opcode, val, &result)) {{
+		return result;
+	}}
+
+	result = producer_compute(opcode, val);
+	if (cache) {{
+		cache->insert(TRANSFORM_CACHE_PRODUCER, opcode, val, result);
+	}}
+	return result;
 }}
 
 unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {{
-	TransformSpec* spec = new TransformSpec;
+	unsigned long long result;
+	if (cache && cache->lookup(TRANSFORM_CACHE_CONSUMER, opcode, val, &result)) {{
+		return result;
+	}}
+
+	result = consumer_compute(opcode, val);
+	if (cache) {{
+		cache->insert(TRANSFORM_CACHE_CONSUMER, opcode, val, result);
+	}}
+	return result;
+}}
 
-	switch (opcode) {{{consumer_spec}
+unsigned long long Transformer::producer_compute(char opcode, unsigned long long val) {{
+	const TransformSpec* spec = lookup(producer_specs, opcode);
+	if (fast_mode && spec->has_composed) {{
+		return composed_transform(spec, val);
+	}}
+
+	switch (opcode) {{{producer_cases}
 	default:
-		assert(false);
+		return transform(spec, val);
+	}}
+}}
+
+unsigned long long Transformer::consumer_compute(char opcode, unsigned long long val) {{
+	const TransformSpec* spec = lookup(consumer_specs, opcode);
+	if (fast_mode && spec->has_composed) {{
+		return composed_transform(spec, val);
 	}}
 
-	return transform(spec, val);
+	switch (opcode) {{{consumer_cases}
+	default:
+		return transform(spec, val);
+	}}
 }}
 
-unsigned long long Transformer::transform(TransformSpec* spec, unsigned long long val) {{
-	while (spec->iterations--) {{
+unsigned long long Transformer::transform(const TransformSpec* spec, unsigned long long val) {{
+	int iterations = spec->iterations;
+	while (iterations--) {{
 		val = (val * spec->a + spec->b) % spec->m;
 	}}
   return val;
 }}
+
+unsigned long long Transformer::composed_transform(const TransformSpec* spec, unsigned long long val) {{
+	if (spec->iterations <= 0) {{
+		return val;
+	}}
+
+	// the first iteration reduces val below m exactly as the loop does
+	val = (val * spec->a + spec->b) % spec->m;
+	return (unsigned long long)(((unsigned __int128)val * spec->composed_a + spec->composed_b) % spec->m);
+}}
+
+void Transformer::producer_transform_batch(const char* opcodes, unsigned long long* vals, int n) {{
+	transform_batch(producer_specs, TRANSFORM_CACHE_PRODUCER, opcodes, vals, n, &Transformer::producer_compute);
+}}
+
+void Transformer::consumer_transform_batch(const char* opcodes, unsigned long long* vals, int n) {{
+	transform_batch(consumer_specs, TRANSFORM_CACHE_CONSUMER, opcodes, vals, n, &Transformer::consumer_compute);
+}}
+
+void Transformer::transform_batch(const TransformSpec* specs, int stage, const char* opcodes, unsigned long long* vals, int n,
+	unsigned long long (Transformer::*single_transform)(char, unsigned long long)) {{
+	unsigned long long group[TRANSFORM_BATCH_CHUNK];
+	int index[TRANSFORM_BATCH_CHUNK];
+
+	// the scalar kernel only runs when asked for by name, the single transforms
+	// have their constants compiled in and are faster; a SIMD kernel the cpu
+	// lacks would fall back to it, so it goes to the single transforms too
+	bool use_kernel = resolve_kernel(kernel) != TRANSFORM_KERNEL_SCALAR || kernel == TRANSFORM_KERNEL_SCALAR;
+
+	for (int begin = 0; begin < n; begin += TRANSFORM_BATCH_CHUNK) {{
+		int count = n - begin < TRANSFORM_BATCH_CHUNK ? n - begin : TRANSFORM_BATCH_CHUNK;
+		bool done[TRANSFORM_BATCH_CHUNK] = {{false}};
+
+		// the cached values are done before any kernel runs
+		if (cache) {{
+			for (int i = 0; i < count; i++) {{
+				done[i] = cache->lookup(stage, opcodes[begin + i], vals[begin + i], &vals[begin + i]);
+			}}
+		}}
+
+		for (int i = 0; i < count; i++) {{
+			if (done[i]) {{
+				continue;
+			}}
+
+			// gather the values of the chunk sharing this opcode
+			char opcode = opcodes[begin + i];
+			const TransformSpec* spec = lookup(specs, opcode);
+			int size = 0;
+			for (int j = i; j < count; j++) {{
+				if (!done[j] && opcodes[begin + j] == opcode) {{
+					index[size] = begin + j;
+					group[size++] = vals[begin + j];
+					done[j] = true;
+				}}
+			}}
+
+			if ((fast_mode && spec->has_composed) || !use_kernel || !spec->has_barrett || spec->iterations < 1 || size < 2) {{
+				for (int k = 0; k < size; k++) {{
+					vals[index[k]] = (this->*single_transform)(opcode, group[k]);
+					if (cache) {{
+						cache->insert(stage, opcode, group[k], vals[index[k]]);
+					}}
+				}}
+				continue;
+			}}
+
+			// the first iteration reduces the values below m exactly as the loop does
+			for (int k = 0; k < size; k++) {{
+				group[k] = (group[k] * spec->a + spec->b) % spec->m;
+			}}
+			run_chains(kernel, spec, group, size, spec->iterations - 1);
+			for (int k = 0; k < size; k++) {{
+				if (cache) {{
+					cache->insert(stage, opcode, vals[index[k]], group[k]);
+				}}
+				vals[index[k]] = group[k];
+			}}
+		}}
+	}}
+}}
 '''
 
 	return template
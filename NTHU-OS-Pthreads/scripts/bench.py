@@ -0,0 +1,137 @@
+import click
+import itertools
+import json
+import os
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from auto_gen_input import generate_items
+
+def parse_list(value, cast=int):
+	return [cast(v) for v in value.split(',') if v]
+
+def workload_spec(spec_file, n, mix):
+	# the value range of the spec's input, with its opcode phases stretched to n
+	# items, or a single phase drawing uniformly from the opcodes in mix
+	with open(spec_file, 'r') as jsonf:
+		spec = json.load(jsonf)
+
+	input_spec = dict(spec['auto_gen_input'])
+	if mix:
+		input_spec['choices'] = {str(n): list(mix)}
+	else:
+		scale = n / spec['n']
+		bounds = sorted(input_spec['choices'], key=int)
+		choices = {str(round(int(c) * scale)): input_spec['choices'][c] for c in bounds}
+		choices[str(n)] = input_spec['choices'][bounds[-1]]
+		input_spec['choices'] = choices
+
+	return input_spec
+
+def write_workload(path, n, input_spec):
+	with open(path, 'w') as f:
+		for key, val, opcode in generate_items(n, input_spec):
+			print(key, val, opcode, file=f)
+
+def build(build_dir, name, defines):
+	binary = os.path.join(build_dir, name)
+	flags = [f'-D{k}={v}' for k, v in defines.items()]
+	subprocess.run(['g++', '-o', binary, '-static', '-std=c++11', '-O3', '-pthread'] + flags +
+		['main.cpp', 'transformer.cpp'], check=True)
+	return binary
+
+def run(binary, n, workload, run_dir, settings):
+	output = os.path.join(run_dir, 'bench.out')
+	flags = [f'--{k}={v}' for k, v in settings.items()]
+	begin = time.monotonic()
+	process = subprocess.Popen([binary, str(n), workload, output] + flags, cwd=run_dir, stdout=subprocess.DEVNULL)
+	# wait4 gives the resource usage of this child alone
+	_, status, rusage = os.wait4(process.pid, 0)
+	elapsed = time.monotonic() - begin
+
+	with open(output, 'r') as f:
+		lines = sum(1 for _ in f)
+	with open(os.path.join(run_dir, 'telemetry.json'), 'r') as f:
+		latency = json.load(f)['latency_us']
+
+	return {
+		'ok': status == 0 and lines == n,
+		'elapsed_sec': elapsed,
+		'items_per_sec': n / elapsed,
+		'p50_us': latency['p50'],
+		'p99_us': latency['p99'],
+		# ru_maxrss is in kilobytes on Linux
+		'peak_rss_mb': rusage.ru_maxrss / 1024,
+	}
+
+@click.command()
+@click.option('--n', default=20000, help='Number of items in the workload.')
+@click.option('--spec', default='./tests/01_spec.json', help='Spec json whose input value range and opcode phases the workload follows.')
+@click.option('--mix', default='', help='Opcodes to draw uniformly from instead of the spec phases, e.g. ABCDE.')
+@click.option('--queue-sizes', default='200,2000', help='Worker queue sizes to sweep.')
+@click.option('--readers', default='1', help='Reader counts to sweep.')
+@click.option('--producers', default='2,4', help='Producer counts to sweep.')
+@click.option('--check-periods', default='100000', help='Controller check periods in microseconds to sweep.')
+@click.option('--policies', default='periodic,adaptive', help='Controller policies to sweep.')
+@click.option('--placements', default='none', help='Thread placements to sweep, e.g. none,stage,colocate; the others are reported as a speedup over none.')
+@click.option('--cache-size', default=0, help='Entries of the transform result cache, 0 for none.')
+@click.option('--fast/--slow', default=True, help='Build with the precomputed fast transform.')
+@click.option('--build-dir', default='./bench_build', help='Where the binaries, workload and outputs go.')
+@click.option('--json-output', default='', help='Also write the results to this json file.')
+def bench(n, spec, mix, queue_sizes, readers, producers, check_periods, policies, placements, cache_size, fast, build_dir, json_output):
+	os.makedirs(build_dir, exist_ok=True)
+	build_dir = os.path.abspath(build_dir)
+
+	workload = os.path.join(build_dir, f'workload_{n}.in')
+	write_workload(workload, n, workload_spec(spec, n, mix))
+
+	# the topology is set at run time, so one binary serves the whole grid
+	binary = build(build_dir, 'main', {'USE_FAST_TRANSFORM': int(fast), 'USE_TELEMETRY': 1})
+
+	results = []
+	header = f'{"queue":>6} {"read":>4} {"prod":>4} {"period_us":>9} {"policy":>8} {"place":>8} {"items/s":>12} {"speedup":>7} {"p50_us":>10} {"p99_us":>10} {"rss_mb":>7}'
+	print(header)
+
+	# none runs first for every point of the grid, so the other placements
+	# can be reported as a speedup over it
+	placement_list = parse_list(placements, str)
+	placement_list.sort(key=lambda placement: placement != 'none')
+
+	grid = itertools.product(parse_list(queue_sizes), parse_list(readers), parse_list(producers),
+		parse_list(check_periods), parse_list(policies, str))
+	for queue_size, num_readers, num_producers, check_period, policy in grid:
+		baseline = None
+		for placement in placement_list:
+			settings = {
+				'worker_queue_size': queue_size,
+				'readers': num_readers,
+				'producers': num_producers,
+				'check_period': check_period,
+				'policy': policy,
+				'placement': placement,
+				'cache_size': cache_size,
+			}
+			result = run(binary, n, workload, build_dir, settings)
+			if placement == 'none':
+				baseline = result['items_per_sec']
+			speedup = result['items_per_sec'] / baseline if baseline else None
+			result.update({'worker_queue_size': queue_size, 'readers': num_readers, 'producers': num_producers,
+				'check_period_us': check_period, 'policy': policy, 'placement': placement, 'speedup': speedup})
+			results.append(result)
+
+			print(f'{queue_size:>6} {num_readers:>4} {num_producers:>4} {check_period:>9} {policy:>8} {placement:>8} '
+				f'{result["items_per_sec"]:>12.0f} ' + (f'{speedup:>6.2f}x' if speedup else f'{"-":>7}') + ' '
+				f'{result["p50_us"]:>10.1f} {result["p99_us"]:>10.1f} {result["peak_rss_mb"]:>7.1f}'
+				+ ('' if result['ok'] else '  FAILED'))
+
+	if json_output:
+		with open(json_output, 'w') as f:
+			json.dump(results, f, indent=2)
+
+	if not all(result['ok'] for result in results):
+		sys.exit(1)
+
+if __name__ == '__main__':
+	bench()
@@ -0,0 +1,89 @@
+#include <string>
+#include <vector>
+#include "thread.hpp"
+#include "queue.hpp"
+#include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_window.hpp"
+#include "mapped_reader.hpp"
+#include "placement.hpp"
+
+#ifndef SHARDED_READER_HPP
+#define SHARDED_READER_HPP
+
+// A Reader that splits the input file into newline-aligned byte ranges and
+// parses them concurrently, one MappedReader per shard, all feeding the same
+// input queue.
+// Every shard knows the line number it starts at, so the items read are the
+// first expected_lines lines of the file, as with a single reader, whichever
+// shard gets ahead. With a window every item is stamped with its line number,
+// so the writer restores the input order within and across shards; the
+// shards then only run as far ahead of the writer as the window allows.
+class ShardedReader : public Thread {
+public:
+	// constructor
+	ShardedReader(int expected_lines, std::string input_file, Queue<Item*>* input_queue, int num_shards, int batch_size = 1, ItemPool* pool = nullptr, ReorderWindow* window = nullptr);
+
+	// destructor
+	~ShardedReader();
+
+	virtual void start() override;
+
+	// pin the shards where placement puts the readers, call before start()
+	void set_placement(Placement* placement);
+private:
+	std::vector<MappedReader*> shards;
+
+	// the method for pthread to create the thread that runs the shards
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+ShardedReader::ShardedReader(int expected_lines, std::string input_file, Queue<Item*>* input_queue, int num_shards, int batch_size, ItemPool* pool, ReorderWindow* window) {
+	for (int i = 0; i < num_shards; i++) {
+		MappedReader* shard = new MappedReader(expected_lines, input_file, input_queue, batch_size, pool, window);
+		shard->set_shard(i, num_shards);
+		shards.push_back(shard);
+	}
+}
+
+ShardedReader::~ShardedReader() {
+	for (MappedReader* shard : shards) {
+		delete shard;
+	}
+}
+
+void ShardedReader::start() {
+	create(ShardedReader::process, (void*)this);
+}
+
+void ShardedReader::set_placement(Placement* placement) {
+	for (size_t i = 0; i < shards.size(); i++) {
+		shards[i]->set_cpu(placement->cpu_for("reader", i));
+	}
+}
+
+void* ShardedReader::process(void* arg) {
+	ShardedReader* reader = (ShardedReader*)arg;
+
+	// a shard's first line number is the number of lines before it;
+	// counting newlines is far cheaper than parsing them
+	long long first_seq = 0;
+	for (MappedReader* shard : reader->shards) {
+		shard->set_first_seq(first_seq);
+		first_seq += shard->count_lines();
+	}
+
+	for (MappedReader* shard : reader->shards) {
+		shard->set_telemetry(reader->telemetry);
+		shard->start();
+	}
+	for (MappedReader* shard : reader->shards) {
+		shard->join();
+	}
+
+	return nullptr;
+}
+
+#endif // SHARDED_READER_HPP
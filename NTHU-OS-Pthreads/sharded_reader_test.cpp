@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "ts_queue.hpp"
+#include "mapped_reader.hpp"
+#include "sharded_reader.hpp"
+#include "writer.hpp"
+#include "config.hpp"
+
+#define SHARDS 3
+#define LINES 150
+// the lines of ./tests/01.in, far more than the reorder window below holds
+#define ORDERED_LINES 4000
+
+// read the first LINES lines of the input with a single reader
+std::vector<Item> read_single(std::string input_file) {
+	TSQueue<Item*>* q = new TSQueue<Item*>(LINES);
+	MappedReader* reader = new MappedReader(LINES, input_file, q);
+	reader->start();
+	reader->join();
+
+	std::vector<Item> items;
+	for (int i = 0; i < LINES; i++) {
+		Item* item = q->dequeue();
+		items.push_back(*item);
+		delete item;
+	}
+
+	delete reader;
+	delete q;
+	return items;
+}
+
+int main() {
+	std::vector<Item> expected = read_single("./tests/00.in");
+
+	// in ordered mode every item carries its line number
+	TSQueue<Item*>* q = new TSQueue<Item*>(LINES);
+	ReorderWindow* window = new ReorderWindow(LINES);
+	ShardedReader* reader = new ShardedReader(LINES, "./tests/00.in", q, SHARDS, 4, nullptr, window);
+	reader->start();
+	reader->join();
+
+	int mismatches = 0;
+	std::vector<bool> seen(LINES, false);
+	for (int i = 0; i < LINES; i++) {
+		Item* item = q->dequeue();
+		if (item->seq < 0 || item->seq >= LINES || seen[item->seq]) {
+			mismatches++;
+		} else {
+			seen[item->seq] = true;
+			const Item& want = expected[item->seq];
+			if (item->key != want.key || item->val != want.val || item->opcode != want.opcode)
+				mismatches++;
+		}
+		delete item;
+	}
+	std::cout << "ordered: " << LINES << " items from " << SHARDS << " shards, " << mismatches << " mismatches" << std::endl;
+
+	delete reader;
+	delete window;
+	delete q;
+
+	// without a window the shards still read the first LINES lines, in any order
+	q = new TSQueue<Item*>(LINES);
+	reader = new ShardedReader(LINES, "./tests/00.in", q, SHARDS, 4);
+	reader->start();
+	reader->join();
+
+	int read = q->get_size();
+	std::vector<Item> items;
+	while (q->get_size() > 0) {
+		Item* item = q->dequeue();
+		items.push_back(*item);
+		delete item;
+	}
+	auto by_key = [](const Item& a, const Item& b) { return a.key < b.key; };
+	std::sort(items.begin(), items.end(), by_key);
+	std::sort(expected.begin(), expected.end(), by_key);
+	mismatches = 0;
+	for (int i = 0; i < read && i < LINES; i++) {
+		if (items[i].key != expected[i].key || items[i].val != expected[i].val || items[i].opcode != expected[i].opcode)
+			mismatches++;
+	}
+	std::cout << "unordered: " << read << " of " << LINES << " items read, " << mismatches << " mismatches" << std::endl;
+	delete reader;
+	delete q;
+
+	// with queues of one item the shard ahead fills the window while the one
+	// owning the next line still needs items; the pool must keep enough free
+	// for it, or the pipeline stalls for good
+	PipelineConfig config = PipelineConfig();
+	config.readers = 2;
+	config.producers = 0;
+	config.reader_queue_size = config.worker_queue_size = config.writer_queue_size = 1;
+	config.batch_size = 1;
+	ItemPool* pool = new ItemPool(config.item_pool_size(0));
+	window = new ReorderWindow(config.reorder_window_size(0));
+	q = new TSQueue<Item*>(config.reader_queue_size);
+	reader = new ShardedReader(ORDERED_LINES, "./tests/01.in", q, config.readers, config.batch_size, pool, window);
+	Writer* writer = new Writer(ORDERED_LINES, "./tests/sharded.out", q, config.batch_size, pool, window);
+	reader->start();
+	writer->start();
+	reader->join();
+	writer->join();
+	delete writer;
+
+	std::ifstream in("./tests/01.in"), out("./tests/sharded.out");
+	std::string want, got;
+	int written = 0;
+	mismatches = 0;
+	while (written < ORDERED_LINES && std::getline(out, got)) {
+		std::getline(in, want);
+		if (got != want)
+			mismatches++;
+		written++;
+	}
+	std::cout << "small queues: " << written << " of " << ORDERED_LINES << " items written in order, " << mismatches << " mismatches" << std::endl;
+	delete reader;
+	delete q;
+	delete window;
+	delete pool;
+
+	return 0;
+}
@@ -0,0 +1,331 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "clock.hpp"
+#include "thread.hpp"
+#include "queue.hpp"
+#include "item.hpp"
+
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+// the most occupancy samples kept per queue, the sampling period doubles
+// every time they fill up so that a run of any length fits
+#define TELEMETRY_MAX_SAMPLES 4096
+// 8 linear sub-buckets for every power of two nanoseconds
+#define TELEMETRY_SUB_BUCKETS 8
+#define TELEMETRY_LATENCY_BUCKETS (64 * TELEMETRY_SUB_BUCKETS)
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// The counters of one pipeline thread.
+// Only the owning thread writes them, so the hot path is plain relaxed
+// loads and stores on memory no other thread writes to.
+struct StageCounters {
+	// the stage the thread belongs to
+	const char* stage;
+
+	// the number of items the thread has handed on
+	std::atomic<long long> items;
+	// when the thread handed on its first and its latest batch
+	std::atomic<long long> first_ns;
+	std::atomic<long long> last_ns;
+
+	// the end-to-end latencies of the items, only recorded by the writer
+	std::atomic<long long> latency[TELEMETRY_LATENCY_BUCKETS];
+	std::atomic<long long> latency_sum_ns;
+	std::atomic<long long> latency_max_ns;
+
+	char pad[CACHE_LINE_SIZE];
+
+	explicit StageCounters(const char* stage);
+
+	// count n more items handed on at now
+	void add(int n, long long now);
+
+	// record the latency of one item
+	void add_latency(long long ns);
+
+	// the latency bucket ns falls into, and the largest latency of a bucket
+	static int bucket(long long ns);
+	static long long bucket_limit(int bucket);
+};
+
+// Collects the counters of all pipeline threads and samples the queues,
+// then writes everything as one JSON document.
+class Telemetry : public Thread {
+public:
+	// constructor
+	explicit Telemetry(int sample_period);
+
+	// destructor
+	~Telemetry();
+
+	// starts the queue sampling thread
+	virtual void start() override;
+
+	// stops the queue sampling thread, join() it afterwards
+	void stop();
+
+	// create the counters of a thread of the given stage
+	StageCounters* register_thread(const char* stage);
+
+	// sample the size of the queue and measure how long callers block in it
+	void register_queue(const char* name, Queue<Item*>* queue);
+
+	// write all the collected data to file as JSON
+	void dump(std::string file);
+private:
+	struct QueueSamples {
+		const char* name;
+		Queue<Item*>* queue;
+		std::vector<int> sizes;
+	};
+
+	// the period between two queue samples in microseconds
+	int sample_period;
+	long long start_ns;
+	std::atomic<bool> stopped;
+
+	// guards threads and queues
+	pthread_mutex_t mutex;
+	std::vector<StageCounters*> threads;
+	std::vector<QueueSamples*> queues;
+
+	// the method for pthread to create the sampling thread
+	static void* process(void* arg);
+};
+
+// Implementation start
+
+StageCounters::StageCounters(const char* stage) : stage(stage) {
+	items.store(0);
+	first_ns.store(0);
+	last_ns.store(0);
+	for (int i = 0; i < TELEMETRY_LATENCY_BUCKETS; i++) {
+		latency[i].store(0);
+	}
+	latency_sum_ns.store(0);
+	latency_max_ns.store(0);
+}
+
+void StageCounters::add(int n, long long now) {
+	if (first_ns.load(std::memory_order_relaxed) == 0)
+		first_ns.store(now, std::memory_order_relaxed);
+	last_ns.store(now, std::memory_order_relaxed);
+	items.store(items.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void StageCounters::add_latency(long long ns) {
+	std::atomic<long long>* counter = &latency[bucket(ns)];
+	counter->store(counter->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	latency_sum_ns.store(latency_sum_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+	if (ns > latency_max_ns.load(std::memory_order_relaxed))
+		latency_max_ns.store(ns, std::memory_order_relaxed);
+}
+
+int StageCounters::bucket(long long ns) {
+	if (ns < TELEMETRY_SUB_BUCKETS)
+		return ns < 0 ? 0 : ns;
+
+	// the position of the highest bit picks the power of two,
+	// the 3 bits below it pick the sub-bucket
+	int octave = 63 - __builtin_clzll(ns);
+	int sub = (ns >> (octave - 3)) & (TELEMETRY_SUB_BUCKETS - 1);
+	return (octave - 2) * TELEMETRY_SUB_BUCKETS + sub;
+}
+
+long long StageCounters::bucket_limit(int bucket) {
+	if (bucket < TELEMETRY_SUB_BUCKETS)
+		return bucket;
+
+	int octave = bucket / TELEMETRY_SUB_BUCKETS + 2;
+	long long sub = bucket % TELEMETRY_SUB_BUCKETS;
+	return ((TELEMETRY_SUB_BUCKETS + sub + 1) << (octave - 3)) - 1;
+}
+
+Telemetry::Telemetry(int sample_period) : sample_period(sample_period) {
+	start_ns = monotonic_ns();
+	stopped.store(false);
+	pthread_mutex_init(&mutex, NULL);
+}
+
+Telemetry::~Telemetry() {
+	for (size_t i = 0; i < threads.size(); i++)
+		delete threads[i];
+	for (size_t i = 0; i < queues.size(); i++)
+		delete queues[i];
+	pthread_mutex_destroy(&mutex);
+}
+
+void Telemetry::start() {
+	start_ns = monotonic_ns();
+	create(Telemetry::process, (void*)this);
+}
+
+void Telemetry::stop() {
+	stopped.store(true);
+}
+
+StageCounters* Telemetry::register_thread(const char* stage) {
+	StageCounters* counters = new StageCounters(stage);
+
+	pthread_mutex_lock(&mutex);
+	threads.push_back(counters);
+	pthread_mutex_unlock(&mutex);
+
+	return counters;
+}
+
+void Telemetry::register_queue(const char* name, Queue<Item*>* queue) {
+	QueueSamples* samples = new QueueSamples;
+	samples->name = name;
+	samples->queue = queue;
+	queue->enable_counting();
+	queue->enable_wait_timing();
+
+	pthread_mutex_lock(&mutex);
+	queues.push_back(samples);
+	pthread_mutex_unlock(&mutex);
+}
+
+void* Telemetry::process(void* arg) {
+	Telemetry* telemetry = (Telemetry*)arg;
+
+	while (!telemetry->stopped.load()) {
+		pthread_mutex_lock(&telemetry->mutex);
+		for (size_t i = 0; i < telemetry->queues.size(); i++) {
+			std::vector<int>& sizes = telemetry->queues[i]->sizes;
+			sizes.push_back(telemetry->queues[i]->queue->get_size());
+
+			if ((int)sizes.size() == TELEMETRY_MAX_SAMPLES) {
+				// keep every other sample and sample half as often from now on
+				for (int j = 0; j < TELEMETRY_MAX_SAMPLES / 2; j++)
+					sizes[j] = sizes[j * 2];
+				sizes.resize(TELEMETRY_MAX_SAMPLES / 2);
+				if (i + 1 == telemetry->queues.size())
+					telemetry->sample_period *= 2;
+			}
+		}
+		pthread_mutex_unlock(&telemetry->mutex);
+
+		usleep(telemetry->sample_period);
+	}
+
+	return nullptr;
+}
+
+void Telemetry::dump(std::string file) {
+	FILE* f = fopen(file.c_str(), "w");
+	if (f == nullptr)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	double elapsed = (monotonic_ns() - start_ns) / 1e9;
+
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"elapsed_sec\": %.6f,\n", elapsed);
+
+	// the stages, in the order their first thread registered
+	fprintf(f, "\t\"stages\": {");
+	std::vector<const char*> stages;
+	for (size_t i = 0; i < threads.size(); i++) {
+		bool seen = false;
+		for (size_t j = 0; j < stages.size(); j++)
+			seen = seen || std::string(stages[j]) == threads[i]->stage;
+		if (!seen)
+			stages.push_back(threads[i]->stage);
+	}
+	for (size_t s = 0; s < stages.size(); s++) {
+		int num_threads = 0;
+		long long items = 0, first = 0, last = 0;
+		for (size_t i = 0; i < threads.size(); i++) {
+			if (std::string(stages[s]) != threads[i]->stage)
+				continue;
+			num_threads++;
+			items += threads[i]->items.load();
+			long long thread_first = threads[i]->first_ns.load();
+			if (thread_first != 0 && (first == 0 || thread_first < first))
+				first = thread_first;
+			if (threads[i]->last_ns.load() > last)
+				last = threads[i]->last_ns.load();
+		}
+		double active = last > first ? (last - first) / 1e9 : 0;
+
+		fprintf(f, "%s\n\t\t\"%s\": {\"threads\": %d, \"items\": %lld, \"active_sec\": %.6f, \"items_per_sec\": %.1f}",
+			s == 0 ? "" : ",", stages[s], num_threads, items, active, active > 0 ? items / active : 0.0);
+	}
+	fprintf(f, "\n\t},\n");
+
+	fprintf(f, "\t\"sample_period_us\": %d,\n", sample_period);
+	fprintf(f, "\t\"queues\": {");
+	for (size_t i = 0; i < queues.size(); i++) {
+		Queue<Item*>* queue = queues[i]->queue;
+		std::vector<int>& sizes = queues[i]->sizes;
+		long long sum = 0;
+		int max = 0;
+		for (size_t j = 0; j < sizes.size(); j++) {
+			sum += sizes[j];
+			max = sizes[j] > max ? sizes[j] : max;
+		}
+
+		fprintf(f, "%s\n\t\t\"%s\": {\"enqueued\": %lld, \"dequeued\": %lld, ", i == 0 ? "" : ",",
+			queues[i]->name, queue->get_enqueued(), queue->get_dequeued());
+		fprintf(f, "\"enqueue_blocked_sec\": %.6f, \"dequeue_blocked_sec\": %.6f, ",
+			queue->get_enqueue_wait_ns() / 1e9, queue->get_dequeue_wait_ns() / 1e9);
+		fprintf(f, "\"occupancy_mean\": %.2f, \"occupancy_max\": %d, \"occupancy\": [",
+			sizes.empty() ? 0.0 : (double)sum / sizes.size(), max);
+		for (size_t j = 0; j < sizes.size(); j++)
+			fprintf(f, "%s%d", j == 0 ? "" : ", ", sizes[j]);
+		fprintf(f, "]}");
+	}
+	fprintf(f, "\n\t},\n");
+
+	// the latency histograms of all threads merged together
+	long long histogram[TELEMETRY_LATENCY_BUCKETS] = {0};
+	long long count = 0, sum_ns = 0, max_ns = 0;
+	for (size_t i = 0; i < threads.size(); i++) {
+		for (int b = 0; b < TELEMETRY_LATENCY_BUCKETS; b++) {
+			histogram[b] += threads[i]->latency[b].load();
+			count += threads[i]->latency[b].load();
+		}
+		sum_ns += threads[i]->latency_sum_ns.load();
+		if (threads[i]->latency_max_ns.load() > max_ns)
+			max_ns = threads[i]->latency_max_ns.load();
+	}
+
+	double percentiles[] = {50, 90, 99, 99.9};
+	const char* names[] = {"p50", "p90", "p99", "p999"};
+	fprintf(f, "\t\"latency_us\": {\"count\": %lld, \"mean\": %.3f, ", count, count ? sum_ns / 1e3 / count : 0.0);
+	for (int p = 0; p < 4; p++) {
+		long long rank = (long long)(count * percentiles[p] / 100), seen = 0;
+		int b = 0;
+		while (b < TELEMETRY_LATENCY_BUCKETS - 1 && seen + histogram[b] <= rank) {
+			seen += histogram[b];
+			b++;
+		}
+		// a bucket only bounds its latencies from above, never report more than the max
+		long long limit = StageCounters::bucket_limit(b) < max_ns ? StageCounters::bucket_limit(b) : max_ns;
+		fprintf(f, "\"%s\": %.3f, ", names[p], count ? limit / 1e3 : 0.0);
+	}
+	fprintf(f, "\"max\": %.3f, \"histogram\": [", max_ns / 1e3);
+	bool first_bucket = true;
+	for (int b = 0; b < TELEMETRY_LATENCY_BUCKETS; b++) {
+		if (histogram[b] == 0)
+			continue;
+		fprintf(f, "%s{\"le\": %.3f, \"count\": %lld}", first_bucket ? "" : ", ",
+			StageCounters::bucket_limit(b) / 1e3, histogram[b]);
+		first_bucket = false;
+	}
+	fprintf(f, "]}\n");
+	fprintf(f, "}\n");
+
+	pthread_mutex_unlock(&mutex);
+	fclose(f);
+}
+
+#endif // TELEMETRY_HPP
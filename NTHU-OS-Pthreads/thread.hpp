@@ -1,10 +1,15 @@
 #include <pthread.h>
+#include <sched.h>
 
 #ifndef THREAD_HPP
 #define THREAD_HPP
 
+class Telemetry;
+
 class Thread {
 public:
+	virtual ~Thread() {}
+
 	// to start a new pthread work
 	virtual void start() = 0;
 
@@ -13,8 +18,23 @@ public:
 
 	// to cancel the pthread work
 	virtual int cancel();
+
+	// report the work of the thread to telemetry, call before start()
+	void set_telemetry(Telemetry* telemetry);
+
+	// run the thread on the given cpu only, -1 for any cpu; call before start()
+	void set_cpu(int cpu);
 protected:
 	pthread_t t;
+
+	// the cpu the thread is pinned to, -1 for any
+	int cpu = -1;
+
+	// create the pthread running routine(arg) on the cpu set by set_cpu()
+	int create(void* (*routine)(void*), void* arg);
+
+	// where the thread reports its work, null when telemetry is off
+	Telemetry* telemetry = nullptr;
 };
 
 int Thread::join() {
@@ -25,4 +45,28 @@ int Thread::cancel() {
 	return pthread_cancel(t);
 }
 
+void Thread::set_telemetry(Telemetry* telemetry) {
+	this->telemetry = telemetry;
+}
+
+void Thread::set_cpu(int cpu) {
+	this->cpu = cpu;
+}
+
+int Thread::create(void* (*routine)(void*), void* arg) {
+	if (cpu < 0)
+		return pthread_create(&t, 0, routine, arg);
+
+	// pin the thread before it runs, so its first touches already happen on its cpu
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	pthread_attr_init(&attr);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	int ret = pthread_create(&t, &attr, routine, arg);
+	pthread_attr_destroy(&attr);
+	return ret;
+}
+
 #endif // THREAD_HPP
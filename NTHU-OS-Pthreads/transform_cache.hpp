@@ -0,0 +1,159 @@
+#include <atomic>
+
+#ifndef TRANSFORM_CACHE_HPP
+#define TRANSFORM_CACHE_HPP
+
+// the number of independent tables, each with its own hit and miss counters
+#define TRANSFORM_CACHE_SHARDS 16
+
+// which transform a cached result belongs to
+#define TRANSFORM_CACHE_PRODUCER 1
+#define TRANSFORM_CACHE_CONSUMER 2
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// A bounded memo of transform results keyed by (stage, opcode, val), shared
+// by all threads without locks.
+// Every shard is a direct-mapped table: a new result simply replaces whatever
+// lived in its slot, so the memory stays at the capacity given at construction.
+// Each slot is guarded by a sequence number that is odd while it is written;
+// a lookup racing with a write sees a changed or odd sequence number and
+// misses, and a write finding the slot busy is dropped instead of waiting.
+class TransformCache {
+public:
+	// constructor, capacity is the total number of slots, rounded up so
+	// every shard has a power of two
+	explicit TransformCache(int capacity);
+
+	// destructor
+	~TransformCache();
+
+	// return whether the result of the stage's transform of val is cached,
+	// and if so store it in result
+	bool lookup(int stage, char opcode, unsigned long long val, unsigned long long* result);
+
+	// remember the result of the stage's transform of val
+	void insert(int stage, char opcode, unsigned long long val, unsigned long long result);
+
+	long long get_hits();
+	long long get_misses();
+	int get_capacity();
+private:
+	struct Slot {
+		std::atomic<unsigned int> seq;
+		// stage << 8 | opcode, 0 while the slot is empty
+		std::atomic<unsigned int> tag;
+		std::atomic<unsigned long long> val;
+		std::atomic<unsigned long long> result;
+	};
+
+	struct Shard {
+		Slot* slots;
+		std::atomic<long long> hits;
+		std::atomic<long long> misses;
+		// keeps the counters away from the next shard's
+		char pad[CACHE_LINE_SIZE];
+	};
+
+	Shard shards[TRANSFORM_CACHE_SHARDS];
+	// the slots per shard minus one
+	unsigned long long mask;
+
+	static unsigned long long hash(unsigned int tag, unsigned long long val);
+};
+
+// Implementation start
+
+TransformCache::TransformCache(int capacity) {
+	unsigned long long per_shard = 1;
+	while (per_shard * TRANSFORM_CACHE_SHARDS < (unsigned long long)capacity)
+		per_shard <<= 1;
+	mask = per_shard - 1;
+
+	for (int i = 0; i < TRANSFORM_CACHE_SHARDS; i++) {
+		shards[i].slots = new Slot[per_shard];
+		for (unsigned long long j = 0; j < per_shard; j++) {
+			shards[i].slots[j].seq.store(0, std::memory_order_relaxed);
+			shards[i].slots[j].tag.store(0, std::memory_order_relaxed);
+		}
+		shards[i].hits.store(0);
+		shards[i].misses.store(0);
+	}
+}
+
+TransformCache::~TransformCache() {
+	for (int i = 0; i < TRANSFORM_CACHE_SHARDS; i++) {
+		delete [] shards[i].slots;
+	}
+}
+
+unsigned long long TransformCache::hash(unsigned int tag, unsigned long long val) {
+	// a multiplicative hash, the bits above 32 pick the shard and the low bits the slot
+	unsigned long long h = (val ^ ((unsigned long long)tag << 56)) * 0x9E3779B97F4A7C15ULL;
+	return h ^ (h >> 29);
+}
+
+bool TransformCache::lookup(int stage, char opcode, unsigned long long val, unsigned long long* result) {
+	unsigned int tag = stage << 8 | (unsigned char)opcode;
+	unsigned long long h = hash(tag, val);
+	Shard* shard = &shards[(h >> 32) % TRANSFORM_CACHE_SHARDS];
+	Slot* slot = &shard->slots[h & mask];
+
+	unsigned int seq = slot->seq.load(std::memory_order_acquire);
+	bool hit = false;
+	if (!(seq & 1)) {
+		unsigned int cached_tag = slot->tag.load(std::memory_order_relaxed);
+		unsigned long long cached_val = slot->val.load(std::memory_order_relaxed);
+		unsigned long long cached_result = slot->result.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot->seq.load(std::memory_order_relaxed) == seq && cached_tag == tag && cached_val == val) {
+			*result = cached_result;
+			hit = true;
+		}
+	}
+
+	if (hit)
+		shard->hits.fetch_add(1, std::memory_order_relaxed);
+	else
+		shard->misses.fetch_add(1, std::memory_order_relaxed);
+	return hit;
+}
+
+void TransformCache::insert(int stage, char opcode, unsigned long long val, unsigned long long result) {
+	unsigned int tag = stage << 8 | (unsigned char)opcode;
+	unsigned long long h = hash(tag, val);
+	Slot* slot = &shards[(h >> 32) % TRANSFORM_CACHE_SHARDS].slots[h & mask];
+
+	unsigned int seq = slot->seq.load(std::memory_order_relaxed);
+	if ((seq & 1) || !slot->seq.compare_exchange_strong(seq, seq + 1, std::memory_order_relaxed))
+		return;
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot->tag.store(tag, std::memory_order_relaxed);
+	slot->val.store(val, std::memory_order_relaxed);
+	slot->result.store(result, std::memory_order_relaxed);
+	slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+long long TransformCache::get_hits() {
+	long long hits = 0;
+	for (int i = 0; i < TRANSFORM_CACHE_SHARDS; i++) {
+		hits += shards[i].hits.load();
+	}
+	return hits;
+}
+
+long long TransformCache::get_misses() {
+	long long misses = 0;
+	for (int i = 0; i < TRANSFORM_CACHE_SHARDS; i++) {
+		misses += shards[i].misses.load();
+	}
+	return misses;
+}
+
+int TransformCache::get_capacity() {
+	return (mask + 1) * TRANSFORM_CACHE_SHARDS;
+}
+
+#endif // TRANSFORM_CACHE_HPP
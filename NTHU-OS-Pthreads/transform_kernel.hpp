@@ -0,0 +1,199 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "transformer.hpp"
+
+#ifndef TRANSFORM_KERNEL_HPP
+#define TRANSFORM_KERNEL_HPP
+
+// The batched transform kernels.
+// They run the chains val -> (val * a + b) % m of several independent values
+// side by side. Every value must already be below m, and the spec must have
+// has_barrett set, which guarantees that every intermediate fits the 32-bit
+// multiplies of the SIMD kernels:
+//   x = val * a + b < 4^bits, reduced with q = ((x >> (bits - 1)) * mu) >> (bits + 1)
+// where mu = floor(4^bits / m). q is at most 2 below x / m, so two conditional
+// subtractions of m finish the reduction exactly.
+
+// the number of chains the scalar kernel interleaves
+#define TRANSFORM_SCALAR_LANES 4
+
+// return the widest kernel the cpu supports
+int best_kernel();
+
+// return the kernel run_chains runs when asked for kernel
+int resolve_kernel(int kernel);
+
+// run steps iterations on the n values of vals with the given kernel,
+// TRANSFORM_KERNEL_AUTO picks best_kernel()
+void run_chains(int kernel, const TransformSpec* spec, unsigned long long* vals, int n, int steps);
+
+// Implementation start
+
+static inline unsigned long long barrett_step(unsigned long long val, unsigned long long a, unsigned long long b,
+	unsigned long long m, unsigned long long mu, int bits) {
+	unsigned long long x = val * a + b;
+	unsigned long long q = ((x >> (bits - 1)) * mu) >> (bits + 1);
+	unsigned long long r = x - q * m;
+	r = r >= m ? r - m : r;
+	return r >= m ? r - m : r;
+}
+
+static void chains_scalar(const TransformSpec* spec, unsigned long long* vals, int n, int steps) {
+	const unsigned long long a = spec->a, b = spec->b, m = spec->m, mu = spec->barrett_mu;
+	const int bits = spec->barrett_bits;
+
+	for (int i = 0; i < n; i += TRANSFORM_SCALAR_LANES) {
+		// the chains are independent, so interleaving them hides the multiply latency
+		unsigned long long lanes[TRANSFORM_SCALAR_LANES] = {0};
+		int count = n - i < TRANSFORM_SCALAR_LANES ? n - i : TRANSFORM_SCALAR_LANES;
+		for (int j = 0; j < count; j++)
+			lanes[j] = vals[i + j];
+
+		for (int s = 0; s < steps; s++) {
+			for (int j = 0; j < TRANSFORM_SCALAR_LANES; j++)
+				lanes[j] = barrett_step(lanes[j], a, b, m, mu, bits);
+		}
+
+		for (int j = 0; j < count; j++)
+			vals[i + j] = lanes[j];
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("avx2")))
+static inline __m256i barrett_step_avx2(__m256i v, __m256i a, __m256i b, __m256i m, __m256i m_1,
+	__m256i mu, __m128i shift_q1, __m128i shift_q) {
+	__m256i x = _mm256_add_epi64(_mm256_mul_epu32(v, a), b);
+	__m256i q = _mm256_srl_epi64(_mm256_mul_epu32(_mm256_srl_epi64(x, shift_q1), mu), shift_q);
+	__m256i r = _mm256_sub_epi64(x, _mm256_mul_epu32(q, m));
+	// r < 3m < 2^63, so the signed compare against m - 1 is exact
+	r = _mm256_sub_epi64(r, _mm256_and_si256(_mm256_cmpgt_epi64(r, m_1), m));
+	return _mm256_sub_epi64(r, _mm256_and_si256(_mm256_cmpgt_epi64(r, m_1), m));
+}
+
+__attribute__((target("avx2")))
+static void chains_avx2(const TransformSpec* spec, unsigned long long* vals, int n, int steps) {
+	const __m256i a = _mm256_set1_epi64x(spec->a);
+	const __m256i b = _mm256_set1_epi64x(spec->b);
+	const __m256i m = _mm256_set1_epi64x(spec->m);
+	const __m256i m_1 = _mm256_set1_epi64x(spec->m - 1);
+	const __m256i mu = _mm256_set1_epi64x(spec->barrett_mu);
+	const __m128i shift_q1 = _mm_cvtsi32_si128(spec->barrett_bits - 1);
+	const __m128i shift_q = _mm_cvtsi32_si128(spec->barrett_bits + 1);
+
+	// two vectors of 4 lanes in flight, a short group is padded with zeros
+	for (int i = 0; i < n; i += 8) {
+		unsigned long long lanes[8] = {0};
+		int count = n - i < 8 ? n - i : 8;
+		for (int j = 0; j < count; j++)
+			lanes[j] = vals[i + j];
+
+		__m256i v0 = _mm256_loadu_si256((__m256i*)lanes);
+		__m256i v1 = _mm256_loadu_si256((__m256i*)(lanes + 4));
+		if (count <= 4) {
+			// a small group fits one vector, the second would be all padding
+			for (int s = 0; s < steps; s++)
+				v0 = barrett_step_avx2(v0, a, b, m, m_1, mu, shift_q1, shift_q);
+		} else {
+			for (int s = 0; s < steps; s++) {
+				v0 = barrett_step_avx2(v0, a, b, m, m_1, mu, shift_q1, shift_q);
+				v1 = barrett_step_avx2(v1, a, b, m, m_1, mu, shift_q1, shift_q);
+			}
+		}
+		_mm256_storeu_si256((__m256i*)lanes, v0);
+		_mm256_storeu_si256((__m256i*)(lanes + 4), v1);
+
+		for (int j = 0; j < count; j++)
+			vals[i + j] = lanes[j];
+	}
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i barrett_step_avx512(__m512i v, __m512i a, __m512i b, __m512i m,
+	__m512i mu, __m128i shift_q1, __m128i shift_q) {
+	__m512i x = _mm512_add_epi64(_mm512_mul_epu32(v, a), b);
+	__m512i q = _mm512_srl_epi64(_mm512_mul_epu32(_mm512_srl_epi64(x, shift_q1), mu), shift_q);
+	__m512i r = _mm512_sub_epi64(x, _mm512_mul_epu32(q, m));
+	r = _mm512_mask_sub_epi64(r, _mm512_cmpge_epu64_mask(r, m), r, m);
+	return _mm512_mask_sub_epi64(r, _mm512_cmpge_epu64_mask(r, m), r, m);
+}
+
+__attribute__((target("avx512f")))
+static void chains_avx512(const TransformSpec* spec, unsigned long long* vals, int n, int steps) {
+	const __m512i a = _mm512_set1_epi64(spec->a);
+	const __m512i b = _mm512_set1_epi64(spec->b);
+	const __m512i m = _mm512_set1_epi64(spec->m);
+	const __m512i mu = _mm512_set1_epi64(spec->barrett_mu);
+	const __m128i shift_q1 = _mm_cvtsi32_si128(spec->barrett_bits - 1);
+	const __m128i shift_q = _mm_cvtsi32_si128(spec->barrett_bits + 1);
+
+	// two vectors of 8 lanes in flight, a short group is padded with zeros
+	for (int i = 0; i < n; i += 16) {
+		unsigned long long lanes[16] = {0};
+		int count = n - i < 16 ? n - i : 16;
+		for (int j = 0; j < count; j++)
+			lanes[j] = vals[i + j];
+
+		__m512i v0 = _mm512_loadu_si512(lanes);
+		__m512i v1 = _mm512_loadu_si512(lanes + 8);
+		if (count <= 8) {
+			// a small group fits one vector, the second would be all padding
+			for (int s = 0; s < steps; s++)
+				v0 = barrett_step_avx512(v0, a, b, m, mu, shift_q1, shift_q);
+		} else {
+			for (int s = 0; s < steps; s++) {
+				v0 = barrett_step_avx512(v0, a, b, m, mu, shift_q1, shift_q);
+				v1 = barrett_step_avx512(v1, a, b, m, mu, shift_q1, shift_q);
+			}
+		}
+		_mm512_storeu_si512(lanes, v0);
+		_mm512_storeu_si512(lanes + 8, v1);
+
+		for (int j = 0; j < count; j++)
+			vals[i + j] = lanes[j];
+	}
+}
+
+#endif
+
+static int detect_kernel() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return TRANSFORM_KERNEL_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return TRANSFORM_KERNEL_AVX2;
+#endif
+	return TRANSFORM_KERNEL_SCALAR;
+}
+
+int best_kernel() {
+	static const int detected = detect_kernel();
+	return detected;
+}
+
+int resolve_kernel(int kernel) {
+	if (kernel == TRANSFORM_KERNEL_AUTO || kernel > best_kernel())
+		return best_kernel();
+	return kernel;
+}
+
+void run_chains(int kernel, const TransformSpec* spec, unsigned long long* vals, int n, int steps) {
+	switch (resolve_kernel(kernel)) {
+#if defined(__x86_64__) || defined(__i386__)
+	case TRANSFORM_KERNEL_AVX512:
+		chains_avx512(spec, vals, n, steps);
+		return;
+	case TRANSFORM_KERNEL_AVX2:
+		chains_avx2(spec, vals, n, steps);
+		return;
+#endif
+	default:
+		chains_scalar(spec, vals, n, steps);
+		return;
+	}
+}
+
+#endif // TRANSFORM_KERNEL_HPP
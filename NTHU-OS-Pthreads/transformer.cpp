@@ -2,112 +2,229 @@
 
 #include <assert.h>
 #include "transformer.hpp"
+#include "transform_kernel.hpp"
+#include "transform_cache.hpp"
+
+// the spec tables are indexed by opcode - OPCODE_BASE,
+// an entry with m == 0 stands for an opcode missing from the spec
+static constexpr char OPCODE_BASE = 'A';
+static constexpr int OPCODE_COUNT = 5;
+
+static constexpr TransformSpec producer_specs[OPCODE_COUNT] = {
+	// 'A': same speed
+	{2003ULL, 183492ULL, 1000000007ULL, 9000000, 607599308ULL, 835969666ULL, true, 1152921496ULL, 30, true},
+	// 'B': consumer faster than producer
+	{2143ULL, 191324ULL, 1000000009ULL, 12000000, 773805835ULL, 175362304ULL, true, 1152921494ULL, 30, true},
+	// 'C': producer faster than consumer
+	{2089ULL, 923134ULL, 1000000021ULL, 5000000, 369428289ULL, 486497162ULL, true, 1152921480ULL, 30, true},
+	// 'D': producer slightly faster than consumer
+	{2677ULL, 912834ULL, 1000000033ULL, 7000000, 683644994ULL, 327493638ULL, true, 1152921466ULL, 30, true},
+	// 'E': consumer slightly faster than producer
+	{2693ULL, 718341ULL, 1000000087ULL, 12000000, 253900622ULL, 624149431ULL, true, 1152921404ULL, 30, true},
+};
+
+static constexpr TransformSpec consumer_specs[OPCODE_COUNT] = {
+	// 'A': same speed
+	{2729ULL, 713423ULL, 1000000093ULL, 9000000, 504792281ULL, 41931559ULL, true, 1152921397ULL, 30, true},
+	// 'B': consumer faster than producer
+	{2617ULL, 193424ULL, 1000000097ULL, 5000000, 611316338ULL, 946192637ULL, true, 1152921392ULL, 30, true},
+	// 'C': producer faster than consumer
+	{2053ULL, 743142ULL, 1000000103ULL, 12000000, 771405168ULL, 406198662ULL, true, 1152921385ULL, 30, true},
+	// 'D': producer slightly faster than consumer
+	{2347ULL, 617345ULL, 1000000123ULL, 12000000, 410799769ULL, 832545534ULL, true, 1152921362ULL, 30, true},
+	// 'E': consumer slightly faster than producer
+	{2521ULL, 4719832ULL, 1000000181ULL, 7000000, 710041693ULL, 862259146ULL, true, 1152921295ULL, 30, true},
+};
+
+static const TransformSpec* lookup(const TransformSpec* specs, char opcode) {
+	assert(opcode >= OPCODE_BASE && opcode < OPCODE_BASE + OPCODE_COUNT);
+	const TransformSpec* spec = &specs[opcode - OPCODE_BASE];
+	assert(spec->m != 0);
+	return spec;
+}
+
+// the transform loop with a, b and m fixed at compile time,
+// so that the compiler can strength-reduce the modulo for every opcode
+template <unsigned long long a, unsigned long long b, unsigned long long m>
+static unsigned long long iterate(unsigned long long val, int iterations) {
+	while (iterations--) {
+		val = (val * a + b) % m;
+	}
+	return val;
+}
+
+Transformer::~Transformer() {
+	delete cache;
+}
+
+void Transformer::enable_cache(int capacity) {
+	delete cache;
+	cache = capacity > 0 ? new TransformCache(capacity) : nullptr;
+}
+
+long long Transformer::get_cache_hits() {
+	return cache ? cache->get_hits() : 0;
+}
+
+long long Transformer::get_cache_misses() {
+	return cache ? cache->get_misses() : 0;
+}
 
 unsigned long long Transformer::producer_transform(char opcode, unsigned long long val) {
-	TransformSpec* spec = new TransformSpec;
+	unsigned long long result;
+	if (cache && cache->lookup(TRANSFORM_CACHE_PRODUCER, opcode, val, &result)) {
+		return result;
+	}
+
+	result = producer_compute(opcode, val);
+	if (cache) {
+		cache->insert(TRANSFORM_CACHE_PRODUCER, opcode, val, result);
+	}
+	return result;
+}
+
+unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {
+	unsigned long long result;
+	if (cache && cache->lookup(TRANSFORM_CACHE_CONSUMER, opcode, val, &result)) {
+		return result;
+	}
+
+	result = consumer_compute(opcode, val);
+	if (cache) {
+		cache->insert(TRANSFORM_CACHE_CONSUMER, opcode, val, result);
+	}
+	return result;
+}
+
+unsigned long long Transformer::producer_compute(char opcode, unsigned long long val) {
+	const TransformSpec* spec = lookup(producer_specs, opcode);
+	if (fast_mode && spec->has_composed) {
+		return composed_transform(spec, val);
+	}
 
 	switch (opcode) {
-	// same speed
 	case 'A':
-		spec->a = 2003;
-		spec->b = 183492;
-		spec->m = 1000000007;
-		spec->iterations = 9000000;
-		break;
-
-	// consumer faster than producer
+		return iterate<2003ULL, 183492ULL, 1000000007ULL>(val, spec->iterations);
 	case 'B':
-		spec->a = 2143;
-		spec->b = 191324;
-		spec->m = 1000000009;
-		spec->iterations = 12000000;
-		break;
-
-	// producer faster than consumer
+		return iterate<2143ULL, 191324ULL, 1000000009ULL>(val, spec->iterations);
 	case 'C':
-		spec->a = 2089;
-		spec->b = 923134;
-		spec->m = 1000000021;
-		spec->iterations = 5000000;
-		break;
-
-	// producer slightly faster than consumer
+		return iterate<2089ULL, 923134ULL, 1000000021ULL>(val, spec->iterations);
 	case 'D':
-		spec->a = 2677;
-		spec->b = 912834;
-		spec->m = 1000000033;
-		spec->iterations = 7000000;
-		break;
-
-	// consumer slightly faster than producer
+		return iterate<2677ULL, 912834ULL, 1000000033ULL>(val, spec->iterations);
 	case 'E':
-		spec->a = 2693;
-		spec->b = 718341;
-		spec->m = 1000000087;
-		spec->iterations = 12000000;
-		break;
-
+		return iterate<2693ULL, 718341ULL, 1000000087ULL>(val, spec->iterations);
 	default:
-		assert(false);
+		return transform(spec, val);
 	}
-
-	return transform(spec, val);
 }
 
-unsigned long long Transformer::consumer_transform(char opcode, unsigned long long val) {
-	TransformSpec* spec = new TransformSpec;
+unsigned long long Transformer::consumer_compute(char opcode, unsigned long long val) {
+	const TransformSpec* spec = lookup(consumer_specs, opcode);
+	if (fast_mode && spec->has_composed) {
+		return composed_transform(spec, val);
+	}
 
 	switch (opcode) {
-	// same speed
 	case 'A':
-		spec->a = 2729;
-		spec->b = 713423;
-		spec->m = 1000000093;
-		spec->iterations = 9000000;
-		break;
-
-	// consumer faster than producer
+		return iterate<2729ULL, 713423ULL, 1000000093ULL>(val, spec->iterations);
 	case 'B':
-		spec->a = 2617;
-		spec->b = 193424;
-		spec->m = 1000000097;
-		spec->iterations = 5000000;
-		break;
-
-	// producer faster than consumer
+		return iterate<2617ULL, 193424ULL, 1000000097ULL>(val, spec->iterations);
 	case 'C':
-		spec->a = 2053;
-		spec->b = 743142;
-		spec->m = 1000000103;
-		spec->iterations = 12000000;
-		break;
-
-	// producer slightly faster than consumer
+		return iterate<2053ULL, 743142ULL, 1000000103ULL>(val, spec->iterations);
 	case 'D':
-		spec->a = 2347;
-		spec->b = 617345;
-		spec->m = 1000000123;
-		spec->iterations = 12000000;
-		break;
-
-	// consumer slightly faster than producer
+		return iterate<2347ULL, 617345ULL, 1000000123ULL>(val, spec->iterations);
 	case 'E':
-		spec->a = 2521;
-		spec->b = 4719832;
-		spec->m = 1000000181;
-		spec->iterations = 7000000;
-		break;
-
+		return iterate<2521ULL, 4719832ULL, 1000000181ULL>(val, spec->iterations);
 	default:
-		assert(false);
+		return transform(spec, val);
 	}
-
-	return transform(spec, val);
 }
 
-unsigned long long Transformer::transform(TransformSpec* spec, unsigned long long val) {
-	while (spec->iterations--) {
+unsigned long long Transformer::transform(const TransformSpec* spec, unsigned long long val) {
+	int iterations = spec->iterations;
+	while (iterations--) {
 		val = (val * spec->a + spec->b) % spec->m;
 	}
   return val;
 }
+
+unsigned long long Transformer::composed_transform(const TransformSpec* spec, unsigned long long val) {
+	if (spec->iterations <= 0) {
+		return val;
+	}
+
+	// the first iteration reduces val below m exactly as the loop does
+	val = (val * spec->a + spec->b) % spec->m;
+	return (unsigned long long)(((unsigned __int128)val * spec->composed_a + spec->composed_b) % spec->m);
+}
+
+void Transformer::producer_transform_batch(const char* opcodes, unsigned long long* vals, int n) {
+	transform_batch(producer_specs, TRANSFORM_CACHE_PRODUCER, opcodes, vals, n, &Transformer::producer_compute);
+}
+
+void Transformer::consumer_transform_batch(const char* opcodes, unsigned long long* vals, int n) {
+	transform_batch(consumer_specs, TRANSFORM_CACHE_CONSUMER, opcodes, vals, n, &Transformer::consumer_compute);
+}
+
+void Transformer::transform_batch(const TransformSpec* specs, int stage, const char* opcodes, unsigned long long* vals, int n,
+	unsigned long long (Transformer::*single_transform)(char, unsigned long long)) {
+	unsigned long long group[TRANSFORM_BATCH_CHUNK];
+	int index[TRANSFORM_BATCH_CHUNK];
+
+	// the scalar kernel only runs when asked for by name, the single transforms
+	// have their constants compiled in and are faster; a SIMD kernel the cpu
+	// lacks would fall back to it, so it goes to the single transforms too
+	bool use_kernel = resolve_kernel(kernel) != TRANSFORM_KERNEL_SCALAR || kernel == TRANSFORM_KERNEL_SCALAR;
+
+	for (int begin = 0; begin < n; begin += TRANSFORM_BATCH_CHUNK) {
+		int count = n - begin < TRANSFORM_BATCH_CHUNK ? n - begin : TRANSFORM_BATCH_CHUNK;
+		bool done[TRANSFORM_BATCH_CHUNK] = {false};
+
+		// the cached values are done before any kernel runs
+		if (cache) {
+			for (int i = 0; i < count; i++) {
+				done[i] = cache->lookup(stage, opcodes[begin + i], vals[begin + i], &vals[begin + i]);
+			}
+		}
+
+		for (int i = 0; i < count; i++) {
+			if (done[i]) {
+				continue;
+			}
+
+			// gather the values of the chunk sharing this opcode
+			char opcode = opcodes[begin + i];
+			const TransformSpec* spec = lookup(specs, opcode);
+			int size = 0;
+			for (int j = i; j < count; j++) {
+				if (!done[j] && opcodes[begin + j] == opcode) {
+					index[size] = begin + j;
+					group[size++] = vals[begin + j];
+					done[j] = true;
+				}
+			}
+
+			if ((fast_mode && spec->has_composed) || !use_kernel || !spec->has_barrett || spec->iterations < 1 || size < 2) {
+				for (int k = 0; k < size; k++) {
+					vals[index[k]] = (this->*single_transform)(opcode, group[k]);
+					if (cache) {
+						cache->insert(stage, opcode, group[k], vals[index[k]]);
+					}
+				}
+				continue;
+			}
+
+			// the first iteration reduces the values below m exactly as the loop does
+			for (int k = 0; k < size; k++) {
+				group[k] = (group[k] * spec->a + spec->b) % spec->m;
+			}
+			run_chains(kernel, spec, group, size, spec->iterations - 1);
+			for (int k = 0; k < size; k++) {
+				if (cache) {
+					cache->insert(stage, opcode, vals[index[k]], group[k]);
+				}
+				vals[index[k]] = group[k];
+			}
+		}
+	}
+}
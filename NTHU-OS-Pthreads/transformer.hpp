@@ -2,17 +2,46 @@
 #ifndef TRANSFORMER_HPP
 #define TRANSFORMER_HPP
 
+// the kernels running batches of same-opcode values side by side
+#define TRANSFORM_KERNEL_AUTO 0
+#define TRANSFORM_KERNEL_SCALAR 1
+#define TRANSFORM_KERNEL_AVX2 2
+#define TRANSFORM_KERNEL_AVX512 3
+
+// the most values a batch transform call groups by opcode at once
+#define TRANSFORM_BATCH_CHUNK 64
+
+// the memo of transform results, see transform_cache.hpp
+class TransformCache;
+
 struct TransformSpec {
   unsigned long long a;
   unsigned long long b;
   unsigned long long m;
   int iterations;
+
+  // the last (iterations - 1) steps folded into one affine map
+  // val -> (val * composed_a + composed_b) % m, precomputed by
+  // auto_gen_transformer.py; only valid when has_composed is set
+  unsigned long long composed_a;
+  unsigned long long composed_b;
+  bool has_composed;
+
+  // the Barrett constants of m, mu = floor(4^barrett_bits / m) where
+  // barrett_bits is the bit length of m; only valid when has_barrett is set,
+  // which auto_gen_transformer.py does when the batch kernels can run the spec
+  unsigned long long barrett_mu;
+  int barrett_bits;
+  bool has_barrett;
 };
 
 class Transformer {
 public:
-  Transformer() {};
-  ~Transformer() {};
+  Transformer() : fast_mode(false) {};
+  // in fast mode the iterations are replaced by the precomputed composed map,
+  // which gives the same results in constant time
+  explicit Transformer(bool fast_mode) : fast_mode(fast_mode) {};
+  ~Transformer();
 
   // the producer's work
   unsigned long long producer_transform(char opcode, unsigned long long val);
@@ -20,8 +49,44 @@ public:
   // the consumer's work
   unsigned long long consumer_transform(char opcode, unsigned long long val);
 
+  // the producer's work on n values at once, vals are replaced by the results;
+  // the values of every opcode run side by side in the lanes of the kernel
+  void producer_transform_batch(const char* opcodes, unsigned long long* vals, int n);
+
+  // the consumer's work on n values at once
+  void consumer_transform_batch(const char* opcodes, unsigned long long* vals, int n);
+
+  // one of TRANSFORM_KERNEL_*, an unsupported kernel falls back to the widest supported one,
+  // or to the single transforms when that is the scalar kernel
+  void set_kernel(int kernel) { this->kernel = kernel; };
+
+  // memoize the results of both stages by (opcode, val) in a cache of
+  // capacity entries shared by all threads, 0 to turn it off; call before
+  // any thread transforms
+  void enable_cache(int capacity);
+
+  // the cache lookups that found a result and that did not
+  long long get_cache_hits();
+  long long get_cache_misses();
+
 private:
-  unsigned long long transform(TransformSpec* spec, unsigned long long val);
+  bool fast_mode;
+  int kernel = TRANSFORM_KERNEL_AUTO;
+  TransformCache* cache = nullptr;
+
+  // the transforms without the cache
+  unsigned long long producer_compute(char opcode, unsigned long long val);
+  unsigned long long consumer_compute(char opcode, unsigned long long val);
+
+  unsigned long long transform(const TransformSpec* spec, unsigned long long val);
+
+  unsigned long long composed_transform(const TransformSpec* spec, unsigned long long val);
+
+  // run the values of every opcode through the kernel, or one by one through
+  // single_transform when the spec does not allow it; the results of stage
+  // are looked up in and added to the cache, if any
+  void transform_batch(const TransformSpec* specs, int stage, const char* opcodes, unsigned long long* vals, int n,
+    unsigned long long (Transformer::*single_transform)(char, unsigned long long));
 };
 
 #endif // TRANSFORMER_HPP
@@ -0,0 +1,76 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "clock.hpp"
+#include "transformer.hpp"
+
+// the opcodes of the spec transformer.cpp was generated with
+#define BENCH_OPCODES "ABCDE"
+
+static double seconds_since(long long begin) {
+	return (monotonic_ns() - begin) / 1e9;
+}
+
+// usage: transformer_bench [values per opcode]
+// runs the producer's work on the same values one by one and through every
+// batch kernel, and reports the speedup of each kernel over the single transform
+int main(int argc, char** argv) {
+	int n = argc > 1 ? atoi(argv[1]) : 16;
+	assert(n > 0);
+
+	const char* opcode_set = BENCH_OPCODES;
+	int num_opcodes = 0;
+	while (opcode_set[num_opcodes])
+		num_opcodes++;
+
+	char* opcodes = new char [n * num_opcodes];
+	unsigned long long* input = new unsigned long long [n * num_opcodes];
+	unsigned long long* expected = new unsigned long long [n * num_opcodes];
+	unsigned long long* vals = new unsigned long long [n * num_opcodes];
+
+	// the opcodes interleaved as in a pipeline batch
+	srand(0);
+	for (int i = 0; i < n * num_opcodes; i++) {
+		opcodes[i] = opcode_set[i % num_opcodes];
+		input[i] = ((unsigned long long)rand() << 32) | rand();
+	}
+
+	Transformer* transformer = new Transformer(false);
+
+	long long begin = monotonic_ns();
+	for (int i = 0; i < n * num_opcodes; i++) {
+		expected[i] = transformer->producer_transform(opcodes[i], input[i]);
+	}
+	double single = seconds_since(begin);
+	printf("%-8s %8.3f s\n", "single", single);
+
+	const char* names[] = {"auto", "scalar", "avx2", "avx512"};
+	int failed = 0;
+	for (int kernel = TRANSFORM_KERNEL_SCALAR; kernel <= TRANSFORM_KERNEL_AVX512; kernel++) {
+		for (int i = 0; i < n * num_opcodes; i++)
+			vals[i] = input[i];
+
+		transformer->set_kernel(kernel);
+		begin = monotonic_ns();
+		transformer->producer_transform_batch(opcodes, vals, n * num_opcodes);
+		double elapsed = seconds_since(begin);
+
+		int wrong = 0;
+		for (int i = 0; i < n * num_opcodes; i++)
+			wrong += vals[i] != expected[i];
+		failed += wrong;
+
+		// kernels the cpu lacks fall back to the widest one it has, or to the
+		// single transforms if that is the scalar kernel
+		printf("%-8s %8.3f s  speedup %.2fx%s\n", names[kernel], elapsed, single / elapsed,
+			wrong ? "  WRONG RESULTS" : "");
+	}
+
+	delete transformer;
+	delete [] opcodes;
+	delete [] input;
+	delete [] expected;
+	delete [] vals;
+
+	return failed == 0 ? 0 : 1;
+}
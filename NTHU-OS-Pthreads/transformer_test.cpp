@@ -0,0 +1,127 @@
+#include <assert.h>
+#include <stdio.h>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include "item.hpp"
+#include "transformer.hpp"
+
+// the number of items also checked against the iterating transform, which is slow
+#define SLOW_CHECK_ITEMS 4
+// the number of items also run through the batch kernels
+#define BATCH_CHECK_ITEMS 16
+// large enough to hold both results of every item of the test, so that
+// the second pass over the items finds most of them in the cache
+#define CACHE_CHECK_SIZE 65536
+// the passes over the items through the cached transformer
+#define CACHE_CHECK_PASSES 2
+
+// usage: transformer_test [input file] [answer file]
+// the answer file must come from the spec transformer.cpp was generated with
+int main(int argc, char** argv) {
+	std::string input_file_name = argc > 1 ? argv[1] : "./tests/01.in";
+	std::string answer_file_name = argc > 2 ? argv[2] : "./tests/01.ans";
+
+	std::ifstream input_ifs(input_file_name);
+	std::ifstream answer_ifs(answer_file_name);
+	assert(input_ifs && answer_ifs);
+
+	std::map<int, Item> answers;
+	Item item;
+	while (answer_ifs >> item) {
+		answers[item.key] = item;
+	}
+
+	Transformer* slow = new Transformer(false);
+	Transformer* fast = new Transformer(true);
+	Transformer* cached = new Transformer(true);
+	cached->enable_cache(CACHE_CHECK_SIZE);
+
+	int checked = 0, failed = 0;
+	char opcodes[BATCH_CHECK_ITEMS];
+	unsigned long long vals[BATCH_CHECK_ITEMS];
+	int keys[BATCH_CHECK_ITEMS];
+	int batched = 0;
+	std::vector<Item> items;
+	while (input_ifs >> item) {
+		items.push_back(item);
+		if (batched < BATCH_CHECK_ITEMS) {
+			opcodes[batched] = item.opcode;
+			vals[batched] = item.val;
+			keys[batched++] = item.key;
+		}
+
+		unsigned long long val = fast->producer_transform(item.opcode, item.val);
+		val = fast->consumer_transform(item.opcode, val);
+
+		if (checked < SLOW_CHECK_ITEMS) {
+			unsigned long long slow_val = slow->producer_transform(item.opcode, item.val);
+			slow_val = slow->consumer_transform(item.opcode, slow_val);
+			if (slow_val != val) {
+				printf("key %d: fast %llu, slow %llu\n", item.key, val, slow_val);
+				failed++;
+			}
+		}
+
+		if (answers.count(item.key) == 0 || answers[item.key].val != val) {
+			printf("key %d: got %llu, expected %llu\n", item.key, val, answers[item.key].val);
+			failed++;
+		}
+		checked++;
+	}
+
+	// the first pass fills the cache, the later ones must hit it and still
+	// agree with the uncached transform
+	for (int pass = 0; pass < CACHE_CHECK_PASSES; pass++) {
+		for (const Item& item : items) {
+			unsigned long long val = fast->producer_transform(item.opcode, item.val);
+			val = fast->consumer_transform(item.opcode, val);
+
+			unsigned long long cached_val = cached->producer_transform(item.opcode, item.val);
+			cached_val = cached->consumer_transform(item.opcode, cached_val);
+			if (cached_val != val) {
+				printf("key %d: pass %d cached %llu, fast %llu\n", item.key, pass, cached_val, val);
+				failed++;
+			}
+		}
+	}
+	if (cached->get_cache_hits() == 0) {
+		printf("cache of %d: no hits\n", CACHE_CHECK_SIZE);
+		failed++;
+	}
+
+	// the batch kernels iterate, so only run the first few items through them;
+	// the second round finds every result in the cache
+	slow->enable_cache(CACHE_CHECK_SIZE);
+	for (int round = 0; round < 2; round++) {
+		char round_opcodes[BATCH_CHECK_ITEMS];
+		unsigned long long round_vals[BATCH_CHECK_ITEMS];
+		for (int i = 0; i < batched; i++) {
+			round_opcodes[i] = opcodes[i];
+			round_vals[i] = vals[i];
+		}
+
+		slow->producer_transform_batch(round_opcodes, round_vals, batched);
+		slow->consumer_transform_batch(round_opcodes, round_vals, batched);
+		for (int i = 0; i < batched; i++) {
+			if (answers[keys[i]].val != round_vals[i]) {
+				printf("key %d: batch round %d %llu, expected %llu\n", keys[i], round, round_vals[i], answers[keys[i]].val);
+				failed++;
+			}
+		}
+	}
+	if (slow->get_cache_hits() < 2 * batched) {
+		printf("batch cache: %lld hits, expected at least %d\n", slow->get_cache_hits(), 2 * batched);
+		failed++;
+	}
+
+	printf("%d items checked, %d of them in a batch, %d failed\n", checked, batched, failed);
+	printf("cache of %d: %lld hits, %lld misses\n", CACHE_CHECK_SIZE, cached->get_cache_hits(), cached->get_cache_misses());
+
+	delete cached;
+	delete fast;
+	delete slow;
+
+	return failed == 0 ? 0 : 1;
+}
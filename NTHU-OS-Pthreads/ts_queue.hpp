@@ -1,29 +1,63 @@
 #include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include "queue.hpp"
 
 #ifndef TS_QUEUE_HPP
 #define TS_QUEUE_HPP
 
+#ifndef DEFAULT_BUFFER_SIZE
 #define DEFAULT_BUFFER_SIZE 200
+#endif
+// the most iterations a caller spins before it blocks, 0 to always block right away
+#define TS_QUEUE_DEFAULT_SPIN_LIMIT 2000
+// the spin budget never shrinks below this, so the queue keeps probing whether
+// spinning pays off again
+#define TS_QUEUE_MIN_SPIN 16
+
+// The self-tuning spin budget of one side (the enqueuers or the dequeuers) of a TSQueue.
+// A spin that sees the queue become ready moves the budget towards twice the
+// iterations it took; a spin that runs out shrinks it by a quarter.
+struct SpinPolicy {
+	// the current budget in iterations, between TS_QUEUE_MIN_SPIN, or max_limit
+	// if that is lower, and max_limit
+	std::atomic<int> limit;
+	int max_limit;
+
+	// the number of spins, and of those the ones that avoided blocking
+	std::atomic<long long> spins;
+	std::atomic<long long> successes;
+};
 
 template <class T>
-class TSQueue {
+class TSQueue : public Queue<T> {
 public:
 	// constructor
 	TSQueue();
 
-	explicit TSQueue(int max_buffer_size);
+	// callers spin for at most spin_limit iterations before they block
+	explicit TSQueue(int max_buffer_size, int spin_limit = TS_QUEUE_DEFAULT_SPIN_LIMIT);
 
 	// destructor
 	~TSQueue();
 
 	// add an element to the end of the queue
-	void enqueue(T item);
+	virtual void enqueue(T item) override;
 
 	// remove and return the first element of the queue
-	T dequeue();
+	virtual T dequeue() override;
+
+	// add n elements to the end of the queue
+	virtual void enqueue_bulk(T* items, int n) override;
+
+	// remove up to max elements from the queue into out
+	virtual int dequeue_bulk(T* out, int max) override;
 
 	// return the number of elements in the queue
-	int get_size();
+	virtual int get_size() override;
+
+	// return the spin statistics of the enqueuers or the dequeuers
+	const SpinPolicy& get_spin_policy(bool enqueuers);
 private:
 	// the maximum buffer size
 	int buffer_size;
@@ -40,6 +74,24 @@ private:
 	pthread_mutex_t mutex;
 	// pthread conditional variable
 	pthread_cond_t cond_enqueue, cond_dequeue;
+
+	// a copy of size that waiters can spin on without the mutex
+	std::atomic<int> spin_size;
+	SpinPolicy enqueue_spin, dequeue_spin;
+
+	// set size, called with mutex held
+	void set_size(int new_size);
+
+	// whether an enqueuer (or a dequeuer) can go on at the given size
+	bool is_ready(int curr_size, bool enqueuer);
+
+	// spin until an enqueuer (or a dequeuer) can go on or the budget runs out,
+	// return whether it can go on; called without mutex held
+	bool spin(bool enqueuer);
+
+	// wait until an enqueuer (or a dequeuer) can go on, spinning first;
+	// called and returns with mutex held
+	void wait_for(bool enqueuer);
 };
 
 // Implementation start
@@ -49,15 +101,28 @@ TSQueue<T>::TSQueue() : TSQueue(DEFAULT_BUFFER_SIZE) {
 }
 
 template <class T>
-TSQueue<T>::TSQueue(int buffer_size) : buffer_size(buffer_size) {
+TSQueue<T>::TSQueue(int buffer_size, int spin_limit) : buffer_size(buffer_size) {
 	// TODO: implements TSQueue constructor
 	pthread_mutex_init(&mutex, NULL);
 	pthread_cond_init(&cond_enqueue, NULL);
 	pthread_cond_init(&cond_dequeue, NULL);
-	buffer = new T [buffer_size];
+	// value-initialised, so the pages are first touched by the constructing thread
+	buffer = new T [buffer_size]();
 	size = 0;
 	head = 0;
 	tail = 0;
+
+	// with a single core the thread we wait for cannot run while we spin
+	if (sysconf(_SC_NPROCESSORS_ONLN) <= 1)
+		spin_limit = 0;
+	spin_size.store(0);
+	SpinPolicy* policies[] = {&enqueue_spin, &dequeue_spin};
+	for (SpinPolicy* policy : policies) {
+		policy->max_limit = spin_limit;
+		policy->limit.store(spin_limit < TS_QUEUE_MIN_SPIN ? spin_limit : TS_QUEUE_MIN_SPIN);
+		policy->spins.store(0);
+		policy->successes.store(0);
+	}
 }
 
 template <class T>
@@ -73,13 +138,12 @@ template <class T>
 void TSQueue<T>::enqueue(T item) {
 	// TODO: enqueues an element to the end of the queue
 	pthread_mutex_lock(&mutex);
-	while (size == buffer_size) {
-		pthread_cond_wait(&cond_enqueue, &mutex);
-	}
+	wait_for(true);
 
 	buffer[tail] = item;
 	tail = (tail + 1) % buffer_size;
-	size = size + 1;
+	set_size(size + 1);
+	this->size_changed(size - 1, size);
 
 	pthread_cond_signal(&cond_dequeue);
 	pthread_mutex_unlock(&mutex);
@@ -89,13 +153,12 @@ template <class T>
 T TSQueue<T>::dequeue() {
 	// TODO: dequeues the first element of the queue
 	pthread_mutex_lock(&mutex);
-	while (size == 0) {
-		pthread_cond_wait(&cond_dequeue, &mutex);
-	}
+	wait_for(false);
 
 	T dequeued_element = buffer[head];
 	head = (head + 1) % buffer_size;
-	size = size - 1;
+	set_size(size - 1);
+	this->size_changed(size + 1, size);
 
 	pthread_cond_signal(&cond_enqueue);
 	pthread_mutex_unlock(&mutex);
@@ -103,6 +166,47 @@ T TSQueue<T>::dequeue() {
 	return dequeued_element;
 }
 
+template <class T>
+void TSQueue<T>::enqueue_bulk(T* items, int n) {
+	pthread_mutex_lock(&mutex);
+	while (n > 0) {
+		wait_for(true);
+
+		// move as many items as there are free slots in one go
+		int count = buffer_size - size < n ? buffer_size - size : n;
+		for (int i = 0; i < count; i++) {
+			buffer[tail] = items[i];
+			tail = (tail + 1) % buffer_size;
+		}
+		set_size(size + count);
+		this->size_changed(size - count, size);
+		items += count;
+		n -= count;
+
+		pthread_cond_broadcast(&cond_dequeue);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+template <class T>
+int TSQueue<T>::dequeue_bulk(T* out, int max) {
+	pthread_mutex_lock(&mutex);
+	wait_for(false);
+
+	int count = size < max ? size : max;
+	for (int i = 0; i < count; i++) {
+		out[i] = buffer[head];
+		head = (head + 1) % buffer_size;
+	}
+	set_size(size - count);
+	this->size_changed(size + count, size);
+
+	pthread_cond_broadcast(&cond_enqueue);
+	pthread_mutex_unlock(&mutex);
+
+	return count;
+}
+
 template <class T>
 int TSQueue<T>::get_size() {
 	// TODO: returns the size of the queue
@@ -113,4 +217,76 @@ int TSQueue<T>::get_size() {
 	return curr_size;
 }
 
+template <class T>
+const SpinPolicy& TSQueue<T>::get_spin_policy(bool enqueuers) {
+	return enqueuers ? enqueue_spin : dequeue_spin;
+}
+
+template <class T>
+void TSQueue<T>::set_size(int new_size) {
+	size = new_size;
+	spin_size.store(new_size, std::memory_order_relaxed);
+}
+
+template <class T>
+bool TSQueue<T>::is_ready(int curr_size, bool enqueuer) {
+	return enqueuer ? curr_size < buffer_size : curr_size > 0;
+}
+
+template <class T>
+bool TSQueue<T>::spin(bool enqueuer) {
+	SpinPolicy* policy = enqueuer ? &enqueue_spin : &dequeue_spin;
+	int limit = policy->limit.load(std::memory_order_relaxed);
+	policy->spins.fetch_add(1, std::memory_order_relaxed);
+
+	// the budget is shared by all callers on this side, racing updates only
+	// lose an adjustment
+	for (int i = 0; i < limit; i++) {
+		if (is_ready(spin_size.load(std::memory_order_relaxed), enqueuer)) {
+			policy->successes.fetch_add(1, std::memory_order_relaxed);
+			int target = 2 * i + TS_QUEUE_MIN_SPIN;
+			int next = limit + (target - limit) / 8;
+			policy->limit.store(next > policy->max_limit ? policy->max_limit : next, std::memory_order_relaxed);
+			return true;
+		}
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+	// the floor is TS_QUEUE_MIN_SPIN, unless the queue allows fewer spins
+	int next = limit - limit / 4;
+	int floor = policy->max_limit < TS_QUEUE_MIN_SPIN ? policy->max_limit : TS_QUEUE_MIN_SPIN;
+	policy->limit.store(next < floor ? floor : next, std::memory_order_relaxed);
+	return false;
+}
+
+template <class T>
+void TSQueue<T>::wait_for(bool enqueuer) {
+	if (is_ready(size, enqueuer))
+		return;
+
+	SpinPolicy* policy = enqueuer ? &enqueue_spin : &dequeue_spin;
+	if (policy->max_limit > 0) {
+		// spin without the mutex, so the thread we wait for can take it;
+		// another waiter may still win the race, then we block as before
+		pthread_mutex_unlock(&mutex);
+		spin(enqueuer);
+		pthread_mutex_lock(&mutex);
+		if (is_ready(size, enqueuer))
+			return;
+	}
+
+	long long wait = 0;
+	while (!is_ready(size, enqueuer)) {
+		if (!wait)
+			wait = this->wait_begin();
+		pthread_cond_wait(enqueuer ? &cond_enqueue : &cond_dequeue, &mutex);
+	}
+	if (enqueuer)
+		this->enqueue_wait_end(wait);
+	else
+		this->dequeue_wait_end(wait);
+}
+
 #endif // TS_QUEUE_HPP
@@ -2,13 +2,18 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <assert.h>
+#include <string.h>
+#include <time.h>
 #include "ts_queue.hpp"
+#include "lock_free_queue.hpp"
+#include "work_stealing_queue.hpp"
 
 /* Global shared variables */
-TSQueue<int>* q;
+Queue<int>* q;
 int num_producer;
 int num_consumer;
 int** result;
+long long bench_items;
 
 void* produce(void* arg) {
 	int tid = *(int*)arg;
@@ -33,33 +38,60 @@ void* consume(void* arg) {
 	return nullptr;
 }
 
+void* bench_produce(void* arg) {
+	for (long long i = 0; i < bench_items; i++) {
+		q->enqueue((int)i);
+	}
+
+	return nullptr;
+}
+
+void* bench_consume(void* arg) {
+	int tid = *(int*)arg;
+
+	// the items are split as evenly as possible over the consumers
+	long long total = bench_items * num_producer;
+	long long share = total / num_consumer + (tid < total % num_consumer ? 1 : 0);
+	for (long long i = 0; i < share; i++) {
+		q->dequeue();
+	}
+
+	return nullptr;
+}
+
 struct Thread {
 	pthread_t t;
 	int id;
 };
 
-int main(int argc, char** argv) {
-	assert(argc == 3);
-
-	q = new TSQueue<int>(20);
-	num_producer = atoi(argv[1]);
-	num_consumer = atoi(argv[2]);
+double elapsed_ms(const struct timespec& begin, const struct timespec& end) {
+	return (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+}
 
-	result = new int*[num_consumer];
-	for (int i = 0; i < num_consumer; i++)
-		result[i] = new int[num_producer];
+Queue<int>* new_queue(const char* mode) {
+	if (strcmp(mode, "lockfree") == 0)
+		return new LockFreeQueue<int>(20);
+	if (strcmp(mode, "stealing") == 0)
+		return new WorkStealingQueue<int>(20, 4);
+	return new TSQueue<int>(20, strcmp(mode, "block") == 0 ? 0 : TS_QUEUE_DEFAULT_SPIN_LIMIT);
+}
 
+// run the producers and consumers over q, return the elapsed time in ms
+double run(void* (*producer)(void*), void* (*consumer)(void*)) {
 	Thread* producers = new Thread[num_producer];
 	Thread* consumers = new Thread[num_consumer];
 
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
 	for (int i = 0; i < num_producer; i++) {
 		producers[i].id = i;
-		pthread_create(&producers[i].t, 0, produce, (void*)&producers[i].id);
+		pthread_create(&producers[i].t, 0, producer, (void*)&producers[i].id);
 	}
 
 	for (int i = 0; i < num_consumer; i++) {
 		consumers[i].id = i;
-		pthread_create(&consumers[i].t, 0, consume, (void*)&consumers[i].id);
+		pthread_create(&consumers[i].t, 0, consumer, (void*)&consumers[i].id);
 	}
 
 	for (int i = 0; i < num_producer; i++) {
@@ -69,6 +101,33 @@ int main(int argc, char** argv) {
 		pthread_join(consumers[i].t, 0);
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	delete [] producers;
+	delete [] consumers;
+	return elapsed_ms(begin, end);
+}
+
+// usage: ts_queue_test <num_producer> <num_consumer> [ts|block|lockfree|stealing] [bench_items_per_producer]
+// checks the given queue; only if bench_items_per_producer is given, it then
+// benchmarks every queue with num_producer producers pushing that many items
+// each to num_consumer consumers, e.g. 200000 so that the time goes to the
+// queue rather than to creating the threads
+int main(int argc, char** argv) {
+	assert(argc >= 3 && argc <= 5);
+
+	const char* mode = argc >= 4 ? argv[3] : "ts";
+	q = new_queue(mode);
+	num_producer = atoi(argv[1]);
+	num_consumer = atoi(argv[2]);
+	bench_items = argc == 5 ? atoll(argv[4]) : 0;
+
+	result = new int*[num_consumer];
+	for (int i = 0; i < num_consumer; i++)
+		result[i] = new int[num_producer];
+
+	run(produce, consume);
+
 	for (int i = 0; i < num_consumer; i++) {
 		printf("consumer %d:", i);
 		for (int j = 0; j < num_producer; j++)
@@ -76,5 +135,24 @@ int main(int argc, char** argv) {
 		printf("\n");
 	}
 
+	if (TSQueue<int>* ts = dynamic_cast<TSQueue<int>*>(q)) {
+		const SpinPolicy& enqueue_spin = ts->get_spin_policy(true);
+		const SpinPolicy& dequeue_spin = ts->get_spin_policy(false);
+		fprintf(stderr, "spins: enqueue %lld/%lld dequeue %lld/%lld succeeded\n",
+			enqueue_spin.successes.load(), enqueue_spin.spins.load(),
+			dequeue_spin.successes.load(), dequeue_spin.spins.load());
+	}
+	delete q;
+
+	// timing goes to stderr so the result lines above stay comparable
+	const char* modes[] = {"ts", "block", "lockfree", "stealing"};
+	for (int i = 0; i < 4 && bench_items > 0; i++) {
+		q = new_queue(modes[i]);
+		double ms = run(bench_produce, bench_consume);
+		long long items = bench_items * num_producer;
+		fprintf(stderr, "%-8s: %lld items in %.3f ms, %.0f items/s\n", modes[i], items, ms, items / ms * 1e3);
+		delete q;
+	}
+
 	return 0;
 }
@@ -0,0 +1,285 @@
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include "queue.hpp"
+
+#ifndef WORK_STEALING_QUEUE_HPP
+#define WORK_STEALING_QUEUE_HPP
+
+#ifndef DEFAULT_BUFFER_SIZE
+#define DEFAULT_BUFFER_SIZE 200
+#endif
+#define DEFAULT_NUM_LANES 8
+
+// A bounded queue split into per-worker lanes.
+// Enqueued batches are spread over the lanes round-robin. A worker dequeues
+// through its own lane (see lane()), taking items from the front of its
+// deque first and stealing from the back of its peers' deques when it runs
+// dry, so workers only contend on a lane lock when they actually meet.
+// The capacity and get_size() cover all lanes together.
+template <class T>
+class WorkStealingQueue : public Queue<T> {
+public:
+	// constructor
+	WorkStealingQueue();
+
+	WorkStealingQueue(int max_buffer_size, int num_lanes);
+
+	// destructor
+	~WorkStealingQueue();
+
+	// add an element to the next lane in round-robin order
+	virtual void enqueue(T item) override;
+
+	// remove and return an element from any lane
+	virtual T dequeue() override;
+
+	// add n elements to the next lane in round-robin order
+	virtual void enqueue_bulk(T* items, int n) override;
+
+	// remove up to max elements from any lane
+	virtual int dequeue_bulk(T* out, int max) override;
+
+	// return the number of elements in all lanes
+	virtual int get_size() override;
+
+	// return the view worker i should use, whose dequeues prefer lane i % num_lanes
+	virtual Queue<T>* lane(int i) override;
+private:
+	class Lane : public Queue<T> {
+	public:
+		WorkStealingQueue<T>* owner;
+		int id;
+
+		// the items of this lane, guarded by mutex
+		std::deque<T> items;
+		pthread_mutex_t mutex;
+
+		virtual void enqueue(T item) override { owner->enqueue(item); }
+		virtual T dequeue() override;
+		virtual void enqueue_bulk(T* items, int n) override { owner->enqueue_bulk(items, n); }
+		virtual int dequeue_bulk(T* out, int max) override { return owner->dequeue_bulk(out, max, id); }
+		virtual int get_size() override { return owner->get_size(); }
+	};
+
+	// the maximum number of elements in all lanes
+	int buffer_size;
+	int num_lanes;
+	Lane* lanes;
+
+	// the number of slots taken by enqueuers, including pushes still in progress
+	std::atomic<int> reserved;
+	// the number of pushed elements not yet claimed by a dequeuer
+	std::atomic<int> available;
+	// the lane the next enqueue goes to
+	std::atomic<unsigned> next_lane;
+
+	// blocked enqueuers and dequeuers sleep here; the waiter counters let the
+	// fast path skip the mutex when nobody is sleeping
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_enqueue, cond_dequeue;
+	std::atomic<int> enqueue_waiters, dequeue_waiters;
+
+	// reserve up to n slots, block until at least one is free
+	int reserve(int n);
+
+	// claim up to n pushed elements, block until at least one is there
+	int claim(int n);
+
+	// take n claimed elements, starting from lane id and stealing from the others
+	void take(T* out, int n, int id);
+
+	int dequeue_bulk(T* out, int max, int id);
+
+	void wake(pthread_cond_t* cond, std::atomic<int>& waiters);
+};
+
+// Implementation start
+
+template <class T>
+WorkStealingQueue<T>::WorkStealingQueue() : WorkStealingQueue(DEFAULT_BUFFER_SIZE, DEFAULT_NUM_LANES) {
+}
+
+template <class T>
+WorkStealingQueue<T>::WorkStealingQueue(int buffer_size, int num_lanes)
+	: buffer_size(buffer_size), num_lanes(num_lanes) {
+	lanes = new Lane [num_lanes];
+	for (int i = 0; i < num_lanes; i++) {
+		lanes[i].owner = this;
+		lanes[i].id = i;
+		pthread_mutex_init(&lanes[i].mutex, NULL);
+	}
+
+	reserved.store(0);
+	available.store(0);
+	next_lane.store(0);
+
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&cond_enqueue, NULL);
+	pthread_cond_init(&cond_dequeue, NULL);
+	enqueue_waiters.store(0);
+	dequeue_waiters.store(0);
+}
+
+template <class T>
+WorkStealingQueue<T>::~WorkStealingQueue() {
+	for (int i = 0; i < num_lanes; i++) {
+		pthread_mutex_destroy(&lanes[i].mutex);
+	}
+	delete [] lanes;
+
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond_enqueue);
+	pthread_cond_destroy(&cond_dequeue);
+}
+
+template <class T>
+void WorkStealingQueue<T>::wake(pthread_cond_t* cond, std::atomic<int>& waiters) {
+	// a waiter registers itself before re-checking the counters, so either it
+	// sees our update or we see it and broadcast after it went to sleep
+	if (waiters.load() > 0) {
+		pthread_mutex_lock(&mutex);
+		pthread_cond_broadcast(cond);
+		pthread_mutex_unlock(&mutex);
+	}
+}
+
+template <class T>
+int WorkStealingQueue<T>::reserve(int n) {
+	while (true) {
+		int curr = reserved.load();
+		if (curr < buffer_size) {
+			int count = buffer_size - curr < n ? buffer_size - curr : n;
+			if (reserved.compare_exchange_weak(curr, curr + count))
+				return count;
+			continue;
+		}
+
+		long long wait = this->wait_begin();
+		pthread_mutex_lock(&mutex);
+		enqueue_waiters++;
+		while (reserved.load() >= buffer_size) {
+			pthread_cond_wait(&cond_enqueue, &mutex);
+		}
+		enqueue_waiters--;
+		pthread_mutex_unlock(&mutex);
+		this->enqueue_wait_end(wait);
+	}
+}
+
+template <class T>
+int WorkStealingQueue<T>::claim(int n) {
+	while (true) {
+		int curr = available.load();
+		if (curr > 0) {
+			int count = curr < n ? curr : n;
+			if (available.compare_exchange_weak(curr, curr - count)) {
+				this->size_changed(curr, curr - count);
+				return count;
+			}
+			continue;
+		}
+
+		long long wait = this->wait_begin();
+		pthread_mutex_lock(&mutex);
+		dequeue_waiters++;
+		while (available.load() <= 0) {
+			pthread_cond_wait(&cond_dequeue, &mutex);
+		}
+		dequeue_waiters--;
+		pthread_mutex_unlock(&mutex);
+		this->dequeue_wait_end(wait);
+	}
+}
+
+template <class T>
+void WorkStealingQueue<T>::take(T* out, int n, int id) {
+	// every claimed element has been pushed and is in some lane, so the scan
+	// terminates even if other workers steal from under us in between
+	int taken = 0;
+	for (int i = 0; taken < n; i = (i + 1) % num_lanes) {
+		Lane* lane = &lanes[(id + i) % num_lanes];
+
+		pthread_mutex_lock(&lane->mutex);
+		while (taken < n && !lane->items.empty()) {
+			if (i == 0) {
+				// our own lane, oldest first
+				out[taken++] = lane->items.front();
+				lane->items.pop_front();
+			} else {
+				// a peer's lane, steal from the end it does not work on
+				out[taken++] = lane->items.back();
+				lane->items.pop_back();
+			}
+		}
+		pthread_mutex_unlock(&lane->mutex);
+	}
+}
+
+template <class T>
+void WorkStealingQueue<T>::enqueue(T item) {
+	enqueue_bulk(&item, 1);
+}
+
+template <class T>
+T WorkStealingQueue<T>::dequeue() {
+	T item;
+	dequeue_bulk(&item, 1);
+	return item;
+}
+
+template <class T>
+void WorkStealingQueue<T>::enqueue_bulk(T* items, int n) {
+	while (n > 0) {
+		int count = reserve(n);
+
+		Lane* lane = &lanes[next_lane++ % num_lanes];
+		pthread_mutex_lock(&lane->mutex);
+		for (int i = 0; i < count; i++) {
+			lane->items.push_back(items[i]);
+		}
+		pthread_mutex_unlock(&lane->mutex);
+
+		int old_size = available.fetch_add(count);
+		this->size_changed(old_size, old_size + count);
+		wake(&cond_dequeue, dequeue_waiters);
+
+		items += count;
+		n -= count;
+	}
+}
+
+template <class T>
+int WorkStealingQueue<T>::dequeue_bulk(T* out, int max) {
+	return dequeue_bulk(out, max, next_lane.load() % num_lanes);
+}
+
+template <class T>
+int WorkStealingQueue<T>::dequeue_bulk(T* out, int max, int id) {
+	int count = claim(max);
+	take(out, count, id);
+
+	reserved -= count;
+	wake(&cond_enqueue, enqueue_waiters);
+
+	return count;
+}
+
+template <class T>
+int WorkStealingQueue<T>::get_size() {
+	return available.load();
+}
+
+template <class T>
+Queue<T>* WorkStealingQueue<T>::lane(int i) {
+	return &lanes[i % num_lanes];
+}
+
+template <class T>
+T WorkStealingQueue<T>::Lane::dequeue() {
+	T item;
+	owner->dequeue_bulk(&item, 1, id);
+	return item;
+}
+
+#endif // WORK_STEALING_QUEUE_HPP
@@ -1,7 +1,10 @@
 #include <fstream>
 #include "thread.hpp"
-#include "ts_queue.hpp"
+#include "queue.hpp"
 #include "item.hpp"
+#include "item_pool.hpp"
+#include "reorder_window.hpp"
+#include "telemetry.hpp"
 
 #ifndef WRITER_HPP
 #define WRITER_HPP
@@ -9,7 +12,7 @@
 class Writer : public Thread {
 public:
 	// constructor
-	Writer(int expected_lines, std::string output_file, TSQueue<Item*>* output_queue);
+	Writer(int expected_lines, std::string output_file, Queue<Item*>* output_queue, int batch_size = 1, ItemPool* pool = nullptr, ReorderWindow* window = nullptr);
 
 	// destructor
 	~Writer();
@@ -21,7 +24,20 @@ private:
 	int expected_lines;
 
 	std::ofstream ofs;
-	TSQueue<Item*> *output_queue;
+	Queue<Item*> *output_queue;
+
+	// the maximum number of items taken from the output queue at once
+	int batch_size;
+	Item** batch;
+
+	// where the written items go back to, they are kept if null
+	ItemPool* pool;
+
+	// puts the items back into input order in ordered output mode, may be null
+	ReorderWindow* window;
+
+	// output an item and hand it back to the pool
+	void write(Item* item);
 
 	// the method for pthread to create a writer thread
 	static void* process(void* arg);
@@ -29,27 +45,58 @@ private:
 
 // Implementation start
 
-Writer::Writer(int expected_lines, std::string output_file, TSQueue<Item*>* output_queue)
-	: expected_lines(expected_lines), output_queue(output_queue) {
+Writer::Writer(int expected_lines, std::string output_file, Queue<Item*>* output_queue, int batch_size, ItemPool* pool, ReorderWindow* window)
+	: expected_lines(expected_lines), output_queue(output_queue), batch_size(batch_size), pool(pool), window(window) {
 	ofs = std::ofstream(output_file);
+	batch = new Item* [batch_size];
 }
 
 Writer::~Writer() {
 	ofs.close();
+	delete [] batch;
 }
 
 void Writer::start() {
 	// TODO: starts a Writer thread
-	pthread_create(&t, 0, Writer::process, (void*)this);
+	create(Writer::process, (void*)this);
+}
+
+void Writer::write(Item* item) {
+	ofs << *item;
+	if (pool)
+		pool->put(item);
 }
 
 void* Writer::process(void* arg) {
 	// TODO: implements the Writer's work
 	Writer* writer = (Writer*)arg;
+	StageCounters* counters = writer->telemetry ? writer->telemetry->register_thread("writer") : nullptr;
+
+	while (writer->expected_lines > 0) {
+		int max = writer->expected_lines < writer->batch_size ? writer->expected_lines : writer->batch_size;
+		int count = writer->output_queue->dequeue_bulk(writer->batch, max);
+		if (counters) {
+			// one clock read covers the whole batch
+			long long now = monotonic_ns();
+			for (int i = 0; i < count; i++) {
+				counters->add_latency(now - writer->batch[i]->born_ns);
+			}
+			counters->add(count, now);
+		}
 
-	while (writer->expected_lines--) {
-		Item *item = writer->output_queue->dequeue();
-		writer->ofs << *item;
+		for (int i = 0; i < count; i++) {
+			if (writer->window)
+				writer->window->insert(writer->batch[i]);
+			else
+				writer->write(writer->batch[i]);
+		}
+		if (writer->window) {
+			while (Item* item = writer->window->pop()) {
+				writer->write(item);
+			}
+			writer->window->commit();
+		}
+		writer->expected_lines -= count;
 	}
 
 	return nullptr;